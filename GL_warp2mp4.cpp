@@ -67,6 +67,23 @@
 #include <string>
 #include <iomanip>
 #include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <deque>
+#include <vector>
+#include <climits>
+#include <csignal>
+#include <algorithm>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "glext.h"
 #include "glInfo.h"                             // glInfo struct
 #include "Timer.h"
@@ -96,6 +113,7 @@ void exitCB();
 
 // function declearations /////////////////////////////////////////////////////
 void initGL();
+void initFixedFunction();
 int  initGLUT(int argc, char **argv);
 bool initSharedMem();
 void clearSharedMem();
@@ -116,6 +134,17 @@ std::string convertInternalFormatToString(GLenum format);
 std::string getTextureParameters(GLuint id);
 std::string getRenderbufferParameters(GLuint id);
 
+// GLSL utils
+GLuint compileShader(GLenum type, const char *source);
+GLuint linkProgram(const char *vertexsource, const char *fragmentsource, bool lookup = false);
+extern const char *warpVertexShader;
+extern const char *lutBuildFragmentShader;
+extern const char *plainFragmentShader;
+extern const char *bicubicFragmentShader;
+extern const char *yuvFragmentShader;
+extern const char *packFragmentShader;
+extern const char *yuvPackFragmentShader;
+
 
 // constants
 int   SCREEN_WIDTH    = 400;
@@ -130,6 +159,15 @@ int   TEXTURE_HEIGHT  = 1080;  // the rendering window size in non-FBO mode
 GLuint fboId;                       // ID of FBO
 GLuint fbotextureId;                   // ID of texture
 GLuint srctextureId;
+GLuint warpProgram;                 // GLSL program for the source, 0 for fixed function
+GLuint yuvProgram;                  // GLSL program converting YUV planes while warping
+GLuint frameProgram;                // program CreateGrid uses for the current frame
+GLuint yuvtextureIds[3];            // Y, U, V planes
+std::vector<GLuint> unpackpboIds;   // ring of pixel unpack buffers for the source uploads
+int unpackpboIndex;                 // next buffer of the ring to fill
+std::vector<size_t> unpackpbobytes; // storage of each, 0 until first filled
+std::vector<GLsync> unpackpbofences;// signalled when its last upload is done
+int uploadingpbo = -1;              // buffer of the upload in progress
 GLuint rboColorId, rboDepthId;      // IDs of Renderbuffer objects
 void *font = GLUT_BITMAP_8_BY_13;
 int screenWidth;
@@ -142,6 +180,11 @@ float cameraAngleY;
 float cameraDistance;
 bool fboSupported;
 bool fboUsed;
+bool pboSupported;
+bool vboSupported;
+bool bufferStorageSupported;
+bool syncSupported;
+bool mapRangeSupported;
 int fboSampleCount;
 int drawMode;
 Timer timer, t1;
@@ -198,6 +241,83 @@ PFNGLISRENDERBUFFERPROC                      pglIsRenderbuffer = 0;
 #define glGetRenderbufferParameteriv             pglGetRenderbufferParameteriv
 #define glIsRenderbuffer                         pglIsRenderbuffer
 
+// GLSL shaders, OpenGL 2.0
+PFNGLCREATESHADERPROC                        pglCreateShader = 0;
+PFNGLDELETESHADERPROC                        pglDeleteShader = 0;
+PFNGLSHADERSOURCEPROC                        pglShaderSource = 0;
+PFNGLCOMPILESHADERPROC                       pglCompileShader = 0;
+PFNGLGETSHADERIVPROC                         pglGetShaderiv = 0;
+PFNGLGETSHADERINFOLOGPROC                    pglGetShaderInfoLog = 0;
+PFNGLCREATEPROGRAMPROC                       pglCreateProgram = 0;
+PFNGLDELETEPROGRAMPROC                       pglDeleteProgram = 0;
+PFNGLATTACHSHADERPROC                        pglAttachShader = 0;
+PFNGLLINKPROGRAMPROC                         pglLinkProgram = 0;
+PFNGLGETPROGRAMIVPROC                        pglGetProgramiv = 0;
+PFNGLGETPROGRAMINFOLOGPROC                   pglGetProgramInfoLog = 0;
+PFNGLUSEPROGRAMPROC                          pglUseProgram = 0;
+PFNGLGETUNIFORMLOCATIONPROC                  pglGetUniformLocation = 0;
+PFNGLUNIFORM1IPROC                           pglUniform1i = 0;
+PFNGLUNIFORM2FPROC                           pglUniform2f = 0;
+PFNGLACTIVETEXTUREPROC                       pglActiveTexture = 0;
+PFNGLUNIFORM4FPROC                           pglUniform4f = 0;
+PFNGLBINDATTRIBLOCATIONPROC                  pglBindAttribLocation = 0;
+PFNGLVERTEXATTRIBPOINTERPROC                 pglVertexAttribPointer = 0;
+PFNGLENABLEVERTEXATTRIBARRAYPROC             pglEnableVertexAttribArray = 0;
+PFNGLDISABLEVERTEXATTRIBARRAYPROC            pglDisableVertexAttribArray = 0;
+
+#define glCreateShader                           pglCreateShader
+#define glDeleteShader                           pglDeleteShader
+#define glShaderSource                           pglShaderSource
+#define glCompileShader                          pglCompileShader
+#define glGetShaderiv                            pglGetShaderiv
+#define glGetShaderInfoLog                       pglGetShaderInfoLog
+#define glCreateProgram                          pglCreateProgram
+#define glDeleteProgram                          pglDeleteProgram
+#define glAttachShader                           pglAttachShader
+#define glLinkProgram                            pglLinkProgram
+#define glGetProgramiv                           pglGetProgramiv
+#define glGetProgramInfoLog                      pglGetProgramInfoLog
+#define glUseProgram                             pglUseProgram
+#define glGetUniformLocation                     pglGetUniformLocation
+#define glUniform1i                              pglUniform1i
+#define glUniform2f                              pglUniform2f
+#define glActiveTexture                          pglActiveTexture
+#define glUniform4f                              pglUniform4f
+#define glBindAttribLocation                     pglBindAttribLocation
+#define glVertexAttribPointer                    pglVertexAttribPointer
+#define glEnableVertexAttribArray                pglEnableVertexAttribArray
+#define glDisableVertexAttribArray               pglDisableVertexAttribArray
+
+// immutable texture storage, ARB_texture_storage / OpenGL 4.2
+PFNGLTEXSTORAGE2DPROC                        pglTexStorage2D = 0;
+#define glTexStorage2D                           pglTexStorage2D
+
+// ARB Pixel Buffer Object
+PFNGLGENBUFFERSARBPROC                       pglGenBuffersARB = 0;                        // VBO Name Generation Procedure
+PFNGLBINDBUFFERARBPROC                       pglBindBufferARB = 0;                        // VBO Bind Procedure
+PFNGLBUFFERDATAARBPROC                       pglBufferDataARB = 0;                        // VBO Data Loading Procedure
+PFNGLDELETEBUFFERSARBPROC                    pglDeleteBuffersARB = 0;                     // VBO Deletion Procedure
+PFNGLMAPBUFFERARBPROC                        pglMapBufferARB = 0;                         // map VBO procedure
+PFNGLUNMAPBUFFERARBPROC                      pglUnmapBufferARB = 0;                       // unmap VBO procedure
+#define glGenBuffers                             pglGenBuffersARB
+#define glBindBuffer                             pglBindBufferARB
+#define glBufferData                             pglBufferDataARB
+#define glDeleteBuffers                          pglDeleteBuffersARB
+#define glMapBuffer                              pglMapBufferARB
+#define glUnmapBuffer                            pglUnmapBufferARB
+
+// persistently mapped buffers and fences, ARB_buffer_storage / OpenGL 4.4
+PFNGLBUFFERSTORAGEPROC                       pglBufferStorage = 0;
+PFNGLMAPBUFFERRANGEPROC                      pglMapBufferRange = 0;
+PFNGLFENCESYNCPROC                           pglFenceSync = 0;
+PFNGLCLIENTWAITSYNCPROC                      pglClientWaitSync = 0;
+PFNGLDELETESYNCPROC                          pglDeleteSync = 0;
+#define glBufferStorage                          pglBufferStorage
+#define glMapBufferRange                         pglMapBufferRange
+#define glFenceSync                              pglFenceSync
+#define glClientWaitSync                         pglClientWaitSync
+#define glDeleteSync                             pglDeleteSync
+
 #endif
 
 
@@ -217,15 +337,18 @@ PFNWGLGETSWAPINTERVALEXTPROC pwglGetSwapIntervalEXT = 0;
 ///////////////////////////////////////////////////////////////////////////////
 void draw()
 {
-    glBindTexture(GL_TEXTURE_2D, fbotextureId);
+    glBindTexture(GL_TEXTURE_2D, previewslot ? batchtextureIds[previewslot - 1] : fbotextureId);
 
     glColor4f(1, 1, 1, 1);
+    // the fbo texture is upside down with flipinmesh
+    float tbottom = flipinmesh ? 1.0f : 0.0f;
+    float ttop = 1.0f - tbottom;
     // Draw a textured quad
 	glBegin(GL_QUADS);
-	glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f, -1.0f);
-	glTexCoord2f(1.0f, 0.0f); glVertex2f(1.0, -1.0f);
-	glTexCoord2f(1.0f, 1.0f); glVertex2f(1.0, 1.0);
-	glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f, 1.0);
+	glTexCoord2f(0.0f, tbottom); glVertex2f(-1.0f, -1.0f);
+	glTexCoord2f(1.0f, tbottom); glVertex2f(1.0, -1.0f);
+	glTexCoord2f(1.0f, ttop); glVertex2f(1.0, 1.0);
+	glTexCoord2f(0.0f, ttop); glVertex2f(-1.0f, 1.0);
 	glEnd();
     //~ just draw the texture on the screen instead of the cube below.
     
@@ -320,9 +443,33 @@ int main(int argc, char **argv)
     outputfourccstr[2] = 'I';
     outputfourccstr[3] = 'D';
     
-    const bool askOutputType = argv[3][0] =='Y';  // If false it will use the Xvid codec type
+    const bool askOutputType = argc > 3 && argv[3][0] =='Y';  // If false it will use the Xvid codec type
     // askOutputType=1 works only on Windows currently
     
+    // optional frame range, as frame numbers or hh:mm:ss.sss timecodes
+    // --start is the first frame rendered, --end the first one not rendered
+    // --input skips the file dialog
+    // --bench decode|warp|encode times one stage on its own, see runBenchmark()
+    std::string startarg, endarg, inputarg;
+    for (int i = 1; i < argc - 1; i++)
+    {
+		if (std::string(argv[i]) == "--start")
+			startarg = argv[++i];
+		else if (std::string(argv[i]) == "--end")
+			endarg = argv[++i];
+		else if (std::string(argv[i]) == "--input")
+			inputarg = argv[++i];
+		else if (std::string(argv[i]) == "--bench")
+			benchmode = argv[++i];
+		else if (std::string(argv[i]) == "--benchframes")
+			benchframes = atoi(argv[++i]);
+	}
+	if (!benchmode.empty() && benchmode != "decode" && benchmode != "warp" && benchmode != "encode")
+	{
+		std::cout << "--bench must be decode, warp or encode." << std::endl;
+		return 1;
+	}
+    
     std::ifstream infile("GL_warp2mp4.ini");
     
     // inputs from ini file
@@ -348,6 +495,74 @@ int main(int argc, char **argv)
 			infile >> outputfourccstr;
 			infile >> tempstring;
 			infile >> strpathtowarpfile;
+			// parameters added later are optional,
+			// older ini files without them keep the defaults
+			infile >> tempstring;
+			infile >> decodequeuedepth;
+			infile >> tempstring;
+			infile >> decodethreads;
+			infile >> tempstring;
+			infile >> segmentframes;
+			infile >> tempstring;
+			infile >> sourcescaling;
+			infile >> tempstring;
+			infile >> flipinmesh;
+			infile >> tempstring;
+			infile >> inputyuv;
+			infile >> tempstring;
+			infile >> imagethreads;
+			infile >> tempstring;
+			infile >> sequencefps;
+			infile >> tempstring;
+			infile >> rawwidth;
+			infile >> tempstring;
+			infile >> rawheight;
+			infile >> tempstring;
+			infile >> skipduplicates;
+			infile >> tempstring;
+			infile >> sourcemipmaps;
+			infile >> tempstring;
+			infile >> uploadpbos;
+			infile >> tempstring;
+			infile >> persistentslots;
+			infile >> tempstring;
+			infile >> warpshaders;
+			infile >> tempstring;
+			infile >> warplut;
+			infile >> tempstring;
+			infile >> previewframes;
+			infile >> tempstring;
+			infile >> previewms;
+			infile >> tempstring;
+			infile >> batchframes;
+			infile >> tempstring;
+			infile >> readbackpbos;
+			infile >> tempstring;
+			infile >> packreadback;
+			infile >> tempstring;
+			infile >> outputyuv;
+			// the command line, with its spaces
+			infile >> tempstring;
+			std::string command;
+			std::getline(infile >> std::ws, command);
+			command.erase(command.find_last_not_of(" \r") + 1);
+			if (!command.empty())
+				yuvcommand = command;
+			infile >> tempstring;
+			infile >> activeregion;
+			// Extra_channels stays the last entry of the ini, with the lines
+			// of the channels after it - new settings go before it, in the
+			// file and here
+			infile >> tempstring;
+			infile >> extrachannels;
+			// one line for each, warp file, output suffix, width and height
+			for (int c = 0; c < extrachannels && infile.good(); c++)
+			{
+				WarpChannel channel = WarpChannel();
+				infile >> channel.warpfile >> channel.suffix >> channel.width >> channel.height;
+				if (infile.good())
+					channels.push_back(channel);
+			}
 			infile.close();
 			
 		  }
@@ -359,11 +574,21 @@ int main(int argc, char **argv)
 	TEXTURE_HEIGHT = outputh;
 	SCREEN_WIDTH = windoww;
 	SCREEN_HEIGHT = windowh;
+	// channel 0 is the one set up above, in the globals
+	channels[0].warpfile = strpathtowarpfile;
+	channels[0].output = &outputVideo;
+	if (!benchmode.empty() && channels.size() > 1)
+	{
+		std::cout << "Benchmarking the first channel only." << std::endl;
+		channels.resize(1);
+	}
 	
 		// video init
 	char const * FilterPatterns[2] =  { "*.avi","*.*" };
-	char const * OpenFileName = tinyfd_openFileDialog(
-		"Open a video file",
+	char const * OpenFileName = inputarg.empty() ? NULL : inputarg.c_str();
+	if (! OpenFileName)
+	OpenFileName = tinyfd_openFileDialog(
+		"Open a video file, or any image of a numbered sequence",
 		"",
 		2,
 		FilterPatterns,
@@ -384,22 +609,109 @@ int main(int argc, char **argv)
 	// reference:
 	// https://docs.opencv.org/3.4/d7/d9e/tutorial_video_write.html
 	
-	inputVideo = VideoCapture(OpenFileName);              // Open input
-	if (!inputVideo.isOpened())
-    {
-        std::cout  << "Could not open the input video: " << OpenFileName << std::endl;
-        return -1;
-    }
+	inputfilename = OpenFileName;
+	std::string OpenFileNamestr = OpenFileName;
+	std::string outputbase;		// output filename, before W and the extension
+	int ex, inputw, inputh;
+	double inputfps;
+	unsigned long long knownframes = 0;	// exact frame count, if known
+	if (isMappedInput(inputfilename))
+	{
+		if (!openMappedInput(inputfilename))
+			return -1;
+		outputbase = OpenFileNamestr.substr(0, OpenFileNamestr.find_last_of('.'));
+		inputw = mappedinput.width;
+		inputh = mappedinput.height;
+		inputfps = mappedinput.fps;
+		ex = 0;		// no input codec, NULL writes uncompressed
+		knownframes = nFrames = mappedinput.frameoffsets.size();
+		std::cout << "Reading " << (mappedinput.yuv ? "Y4M" : "raw BGR") 
+			<< " frames directly from the memory mapped file." << std::endl;
+		
+		// I420 frames go straight to the YUV planes when possible
+		if (mappedinput.yuv && !inputyuv)
+			inputyuv = 1;
+		decodequeuedepth = 0;	// nothing to decode
+	}
+	else if (isImageSequence(inputfilename))
+	{
+		if (!listImageSequence(inputfilename, outputbase))
+		{
+			std::cout  << "Could not find the image sequence: " << OpenFileName << std::endl;
+			return -1;
+		}
+		Mat firstimage = imread(sequencefiles[0], IMREAD_COLOR);
+		if (firstimage.empty())
+		{
+			std::cout  << "Could not read the image: " << sequencefiles[0] << std::endl;
+			return -1;
+		}
+		inputw = firstimage.cols;
+		inputh = firstimage.rows;
+		inputfps = sequencefps;
+		ex = 0;		// no input codec, NULL writes uncompressed
+		knownframes = nFrames = sequencefiles.size();
+		std::cout << "Image sequence starting with " << sequencefiles[0] << std::endl;
+		
+		// images are always read as BGR, and only through the decode threads
+		inputyuv = 0;
+		if (imagethreads < 1)
+			imagethreads = 1;
+		if (decodequeuedepth <= 0)
+			decodequeuedepth = imagethreads;
+	}
+	else
+	{
+		inputVideo = VideoCapture(OpenFileName);              // Open input
+		if (!inputVideo.isOpened())
+		{
+			std::cout  << "Could not open the input video: " << OpenFileName << std::endl;
+			return -1;
+		}
+		std::string::size_type pAt = OpenFileNamestr.find_last_of('.');                  // Find extension point
+		outputbase = OpenFileNamestr.substr(0, pAt);
+		inputfps = inputVideo.get(CAP_PROP_FPS);
+		ex = static_cast<int>(inputVideo.get(CAP_PROP_FOURCC));     // Get Codec Type- Int form
+		inputw = (int) inputVideo.get(CAP_PROP_FRAME_WIDTH);
+		inputh = (int) inputVideo.get(CAP_PROP_FRAME_HEIGHT);
+		nFrames = inputVideo.get(CAP_PROP_FRAME_COUNT);
+	}
+     
+    if (!startarg.empty())
+		startframe = parseFrameOrTimecode(startarg, inputfps);
+	if (!endarg.empty())
+		endframe = parseFrameOrTimecode(endarg, inputfps);
+	if (endframe && endframe <= startframe)
+	{
+		std::cout << "--end must be after --start." << std::endl;
+		return -1;
+	}
+	// decoding, and the frame counter, begin at startframe
+	nextsegmentstart = nextframeout = framenum = startframe;
+	if (endframe)
+		decodeendframe = endframe;
+	if (knownframes && knownframes < decodeendframe)
+		decodeendframe = knownframes;
+	std::stringstream rangesuffix;
+	if (startframe || endframe)
+	{
+		rangesuffix << "_" << startframe << "-";
+		std::cout << "Rendering from frame " << startframe;
+		if (endframe)
+		{
+			rangesuffix << endframe;
+			std::cout << " up to frame " << endframe;
+		}
+		std::cout << std::endl;
+	}
+	// never overwrite a real render with benchmark frames
+	if (!benchmode.empty())
+		rangesuffix << "_bench";
      
-    std::string OpenFileNamestr = OpenFileName;    
-    std::string::size_type pAt = OpenFileNamestr.find_last_of('.');                  // Find extension point
-    const std::string NAME = OpenFileNamestr.substr(0, pAt) + "W" + ".avi";   // Form the new name with container
-    int ex = static_cast<int>(inputVideo.get(CAP_PROP_FOURCC));     // Get Codec Type- Int form
+    const std::string NAME = outputbase + "W" + rangesuffix.str() + ".avi";   // Form the new name with container
     // Transform from int to char via Bitwise operators
     char EXT[] = {(char)(ex & 0XFF) , (char)((ex & 0XFF00) >> 8),(char)((ex & 0XFF0000) >> 16),(char)((ex & 0XFF000000) >> 24), 0};
     
-    int inputw = (int) inputVideo.get(CAP_PROP_FRAME_WIDTH);
-    int inputh = (int) inputVideo.get(CAP_PROP_FRAME_HEIGHT);
     Size S = Size(inputw, inputh);   // Acquire input size
                   
     Size Sout = Size(outputw,outputh);
@@ -408,7 +720,6 @@ int main(int argc, char **argv)
     src.create(inputh, inputw, CV_8UC3);	// (rows, columns, type)  
     src = 0;   
     
-    nFrames = inputVideo.get(CAP_PROP_FRAME_COUNT);
     std::cout << "Input frame resolution: Width=" << S.width << "  Height=" << S.height
          << " of nr#: " << nFrames << std::endl;
     std::cout << "Input codec type: " << EXT << std::endl;
@@ -416,7 +727,17 @@ int main(int argc, char **argv)
     t_start = time(NULL);
 	fps = 0;
 	
+	// the YUV planes are uploaded as they are, top row first
+	if (inputyuv)
+		flipinmesh = 1;
 	ReadMesh(strpathtowarpfile);
+	for (size_t c = 1; c < channels.size(); c++)
+	{
+		useChannel(c);
+		std::cout << "Channel " << c << ": ";
+		ReadMesh(channels[c].warpfile);
+	}
+	useChannel(0);
 		
     // init global vars
     initSharedMem();
@@ -429,33 +750,54 @@ int main(int argc, char **argv)
     initGL();
 
     // create a texture object for fbo
+    // it is only drawn as the preview, shrunk to the window,
+    // so it needs just the mip levels down to the window size
+    float previewratio = std::max((float)TEXTURE_WIDTH / SCREEN_WIDTH, (float)TEXTURE_HEIGHT / SCREEN_HEIGHT);
+    fbolevels = mipLevelsNeeded(previewratio, TEXTURE_WIDTH, TEXTURE_HEIGHT);
     glGenTextures(1, &fbotextureId);
     glBindTexture(GL_TEXTURE_2D, fbotextureId);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, fbolevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, fbolevels - 1);
     //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
     //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE); // automatic mipmap generation included in OpenGL v1.4
+    glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, fbolevels > 1 ? GL_TRUE : GL_FALSE); // automatic mipmap generation included in OpenGL v1.4
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, TEXTURE_WIDTH, TEXTURE_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
     //glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA, TEXTURE_WIDTH, TEXTURE_HEIGHT, 0, GL_BGRA, GL_UNSIGNED_BYTE, 0);
     // BGRA doesn't work - framebuffer incomplete error.
     glBindTexture(GL_TEXTURE_2D, 0);
     
-    // create texture object for src - from GL2AviView
-    glGenTextures(1, &srctextureId);
-   
-	glBindTexture(GL_TEXTURE_2D, srctextureId);
-   
-	glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP);
-	glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR); 
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-	//~ glTexEnvf(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_MODULATE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texturew, textureh, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-	glBindTexture(GL_TEXTURE_2D, 0);
+    // in native mode, the frame is uploaded at its own size
+    // and the warp does the scaling, as mesh u,v are normalized.
+    // Otherwise it is resized on the CPU to Internal_texture_width/height.
+    if (sourcescaling > 0)
+    {
+		GLint maxtexturesize = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxtexturesize);
+		if (inputw <= maxtexturesize && inputh <= maxtexturesize)
+		{
+			texturew = inputw;
+			textureh = inputh;
+			std::cout << "Uploading frames at native resolution " << texturew << "x" << textureh << std::endl;
+		}
+		else
+		{
+			// still native size, but split over several textures
+			texturew = inputw;
+			textureh = inputh;
+			sourcetilesize = maxtexturesize;
+			std::cout << "Input is larger than GL_MAX_TEXTURE_SIZE " << maxtexturesize 
+				<< ", uploading it as tiles." << std::endl;
+			if (sourcescaling == 2)
+			{
+				std::cout << "The bicubic filter shader does not work with tiles, using GL_LINEAR." << std::endl;
+				sourcescaling = 1;
+			}
+		}
+	}
     
     // get OpenGL info
     glInfo glInfo;
@@ -505,6 +847,81 @@ int main(int argc, char **argv)
         }
     }
 
+    // GLSL shaders
+    glCreateShader                        = (PFNGLCREATESHADERPROC)wglGetProcAddress("glCreateShader");
+    glDeleteShader                        = (PFNGLDELETESHADERPROC)wglGetProcAddress("glDeleteShader");
+    glShaderSource                        = (PFNGLSHADERSOURCEPROC)wglGetProcAddress("glShaderSource");
+    glCompileShader                       = (PFNGLCOMPILESHADERPROC)wglGetProcAddress("glCompileShader");
+    glGetShaderiv                         = (PFNGLGETSHADERIVPROC)wglGetProcAddress("glGetShaderiv");
+    glGetShaderInfoLog                    = (PFNGLGETSHADERINFOLOGPROC)wglGetProcAddress("glGetShaderInfoLog");
+    glCreateProgram                       = (PFNGLCREATEPROGRAMPROC)wglGetProcAddress("glCreateProgram");
+    glDeleteProgram                       = (PFNGLDELETEPROGRAMPROC)wglGetProcAddress("glDeleteProgram");
+    glAttachShader                        = (PFNGLATTACHSHADERPROC)wglGetProcAddress("glAttachShader");
+    glLinkProgram                         = (PFNGLLINKPROGRAMPROC)wglGetProcAddress("glLinkProgram");
+    glGetProgramiv                        = (PFNGLGETPROGRAMIVPROC)wglGetProcAddress("glGetProgramiv");
+    glGetProgramInfoLog                   = (PFNGLGETPROGRAMINFOLOGPROC)wglGetProcAddress("glGetProgramInfoLog");
+    glUseProgram                          = (PFNGLUSEPROGRAMPROC)wglGetProcAddress("glUseProgram");
+    glGetUniformLocation                  = (PFNGLGETUNIFORMLOCATIONPROC)wglGetProcAddress("glGetUniformLocation");
+    glUniform1i                           = (PFNGLUNIFORM1IPROC)wglGetProcAddress("glUniform1i");
+    glUniform2f                           = (PFNGLUNIFORM2FPROC)wglGetProcAddress("glUniform2f");
+    glActiveTexture                       = (PFNGLACTIVETEXTUREPROC)wglGetProcAddress("glActiveTexture");
+    glUniform4f                           = (PFNGLUNIFORM4FPROC)wglGetProcAddress("glUniform4f");
+    glBindAttribLocation                  = (PFNGLBINDATTRIBLOCATIONPROC)wglGetProcAddress("glBindAttribLocation");
+    glVertexAttribPointer                 = (PFNGLVERTEXATTRIBPOINTERPROC)wglGetProcAddress("glVertexAttribPointer");
+    glEnableVertexAttribArray             = (PFNGLENABLEVERTEXATTRIBARRAYPROC)wglGetProcAddress("glEnableVertexAttribArray");
+    glDisableVertexAttribArray            = (PFNGLDISABLEVERTEXATTRIBARRAYPROC)wglGetProcAddress("glDisableVertexAttribArray");
+
+    // immutable texture storage
+    if(glInfo.isExtensionSupported("GL_ARB_texture_storage"))
+        glTexStorage2D                    = (PFNGLTEXSTORAGE2DPROC)wglGetProcAddress("glTexStorage2D");
+
+    // check PBO is supported by your video card
+    if(glInfo.isExtensionSupported("GL_ARB_pixel_buffer_object"))
+    {
+        // get pointers to GL functions
+        glGenBuffers                      = (PFNGLGENBUFFERSARBPROC)wglGetProcAddress("glGenBuffersARB");
+        glBindBuffer                      = (PFNGLBINDBUFFERARBPROC)wglGetProcAddress("glBindBufferARB");
+        glBufferData                      = (PFNGLBUFFERDATAARBPROC)wglGetProcAddress("glBufferDataARB");
+        glDeleteBuffers                   = (PFNGLDELETEBUFFERSARBPROC)wglGetProcAddress("glDeleteBuffersARB");
+        glMapBuffer                       = (PFNGLMAPBUFFERARBPROC)wglGetProcAddress("glMapBufferARB");
+        glUnmapBuffer                     = (PFNGLUNMAPBUFFERARBPROC)wglGetProcAddress("glUnmapBufferARB");
+
+        // check once again PBO extension
+        if(glGenBuffers && glBindBuffer && glBufferData && glDeleteBuffers &&
+           glMapBuffer && glUnmapBuffer)
+        {
+            pboSupported = vboSupported = true;
+            std::cout << "Video card supports GL_ARB_pixel_buffer_object." << std::endl;
+        }
+        else
+        {
+            pboSupported = false;
+            std::cout << "Video card does NOT support GL_ARB_pixel_buffer_object." << std::endl;
+        }
+    }
+
+    // check ARB_sync is supported, for the fences of the upload slots and readbacks
+    syncSupported = false;
+    if(glInfo.isExtensionSupported("GL_ARB_sync"))
+    {
+        glFenceSync                       = (PFNGLFENCESYNCPROC)wglGetProcAddress("glFenceSync");
+        glClientWaitSync                  = (PFNGLCLIENTWAITSYNCPROC)wglGetProcAddress("glClientWaitSync");
+        glDeleteSync                      = (PFNGLDELETESYNCPROC)wglGetProcAddress("glDeleteSync");
+        syncSupported = glFenceSync && glClientWaitSync && glDeleteSync;
+    }
+
+    // glMapBufferRange, core since OpenGL 3.0, for the upload buffers
+    glMapBufferRange                      = (PFNGLMAPBUFFERRANGEPROC)wglGetProcAddress("glMapBufferRange");
+    mapRangeSupported = pboSupported && glMapBufferRange;
+
+    // check ARB_buffer_storage is supported, for the persistent upload slots
+    bufferStorageSupported = false;
+    if(pboSupported && syncSupported && glInfo.isExtensionSupported("GL_ARB_buffer_storage"))
+    {
+        glBufferStorage                   = (PFNGLBUFFERSTORAGEPROC)wglGetProcAddress("glBufferStorage");
+        bufferStorageSupported = glBufferStorage && glMapBufferRange;
+    }
+
     // check EXT_swap_control is supported
     if(glInfo.isExtensionSupported("WGL_EXT_swap_control"))
     {
@@ -530,7 +947,144 @@ int main(int argc, char **argv)
         fboSupported = fboUsed = false;
         std::cout << "Video card does NOT support GL_ARB_framebuffer_object." << std::endl;
     }
+
+    if(glInfo.isExtensionSupported("GL_ARB_pixel_buffer_object"))
+    {
+        pboSupported = true;
+        std::cout << "Video card supports GL_ARB_pixel_buffer_object." << std::endl;
+    }
+    else
+    {
+        pboSupported = false;
+        std::cout << "Video card does NOT support GL_ARB_pixel_buffer_object." << std::endl;
+    }
+
+    syncSupported = glInfo.isExtensionSupported("GL_ARB_sync");
+    mapRangeSupported = pboSupported && glInfo.isExtensionSupported("GL_ARB_map_buffer_range");
+    bufferStorageSupported = pboSupported && syncSupported && glInfo.isExtensionSupported("GL_ARB_buffer_storage");
+    vboSupported = true;	// OpenGL 1.5
+#endif
+
+    // for meshes about as dense as the output, the warp is
+    // rendered once into a lookup texture, see initWarpLUT
+    if(warplut && warpshaders && fboSupported && !sourcetilesize)
+		initWarpLUT();
+
+    // the warp itself in GLSL, with only the orthographic
+    // mapping of the mesh instead of the fixed function matrices
+    if(warpshaders)
+    {
+		const char *fragmentsource = sourcescaling == 2 ? bicubicFragmentShader : plainFragmentShader;
+		warpProgram = linkProgram(warpVertexShader, fragmentsource, lutTextureId != 0);
+		if (!warpProgram && lutTextureId)
+		{
+			std::cout << "Lookup texture shader not available, drawing the mesh." << std::endl;
+			glDeleteTextures(1, &lutTextureId);
+			lutTextureId = 0;
+			warpProgram = linkProgram(warpVertexShader, fragmentsource);
+		}
+		if (warpProgram)
+			std::cout << "Warping with GLSL shaders." << std::endl;
+		else
+		{
+			std::cout << "Warp shaders not available, using the fixed function pipeline." << std::endl;
+			warpshaders = 0;
+			initFixedFunction();
+		}
+	}
+    if(sourcescaling == 2 && !warpshaders)
+		warpProgram = linkProgram(NULL, bicubicFragmentShader);
+    if(warpProgram)
+    {
+		glUseProgram(warpProgram);
+		glUniform1i(glGetUniformLocation(warpProgram, "src"), 0);
+		if(sourcescaling == 2)
+			glUniform2f(glGetUniformLocation(warpProgram, "texsize"), (float)texturew, (float)textureh);
+		setMeshOrtho(warpProgram);
+		setLUTUniforms(warpProgram);
+		glUseProgram(0);
+	}
+    if(sourcescaling == 2)
+    {
+		if (warpProgram)
+			std::cout << "Using bicubic filter shader for the source." << std::endl;
+		else
+			std::cout << "Bicubic filter shader not available, using GL_LINEAR." << std::endl;
+	}
+	
+	if(inputyuv && (sourcescaling == 0 || sourcetilesize))
+	{
+		std::cout << "YUV input needs native size, untiled textures, decoding to BGR instead." << std::endl;
+		inputyuv = 0;
+	}
+	if(inputyuv > 1)
+		inputyuv = 1;	// NV12, from older ini files, is not asked for any more
+	if(inputyuv && !decodesToI420())
+	{
+		std::cout << "The decoder does not hand over I420 frames, decoding to BGR instead." << std::endl;
+		inputyuv = 0;
+	}
+	if(inputyuv)
+		initYUV();
+	
+    // create texture object for src - from GL2AviView
+    // Its storage is allocated once here, every frame only replaces
+    // the contents with glTexSubImage2D, and the mipmaps, if used,
+    // are generated on the GPU.
+    // With Source_mipmaps = 1, the mesh decides how many levels are
+    // ever sampled, often none beyond the base level.
+    sourcelevels = 1;
+    if (sourcemipmaps == 1)
+    {
+		// the source is shared, so the levels are for the worst of the meshes
+		float minification = 0;
+		for (size_t c = 0; c < channels.size(); c++)
+		{
+			useChannel(c);
+			minification = std::max(minification, meshMinification(texturew, textureh));
+		}
+		useChannel(0);
+		sourcelevels = mipLevelsNeeded(minification, texturew, textureh);
+		std::cout << "The mesh shrinks the source by up to " << minification << ":1, using " 
+			<< sourcelevels << " mip level(s)." << std::endl;
+	}
+	else if (sourcemipmaps == 2)
+		sourcelevels = mipLevelsNeeded(1e9f, texturew, textureh);
+#ifdef _WIN32
+	texstorageSupported = glTexStorage2D != 0;
+#else
+	texstorageSupported = glInfo.isExtensionSupported("GL_ARB_texture_storage");
 #endif
+    glGenTextures(1, &srctextureId);
+	glBindTexture(GL_TEXTURE_2D, srctextureId);
+	glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP);
+	glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP);
+	//~ glTexEnvf(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_MODULATE);
+	if (sourcetilesize)
+		initSourceTiles();	// srctextureId stays empty
+	else
+		allocSourceTexture(texturew, textureh);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	uploadMeshBuffers(meshvboId, meshvertices, &meshiboId, &meshindices);
+	if (lutTextureId)
+		uploadMeshBuffers(lutquadvboId, lutquad, NULL, NULL);
+	
+	// the buffers get their storage when the first frames are copied in
+	if(uploadpbos > 0 && pboSupported)
+	{
+		unpackpboIds.resize(uploadpbos);
+		glGenBuffers(uploadpbos, &unpackpboIds[0]);
+		unpackpbobytes.assign(uploadpbos, 0);
+		unpackpbofences.assign(uploadpbos, (GLsync)0);
+		unpackpboIndex = 0;
+		std::cout << "Uploading frames through " << uploadpbos << " pixel buffer objects." << std::endl;
+	}
+	// the slots are created by startDecoder, once it knows how many are needed
+	if(persistentslots && !bufferStorageSupported)
+	{
+		std::cout << "Video card does NOT support GL_ARB_buffer_storage, decoding into client memory." << std::endl;
+		persistentslots = 0;
+	}
 
     if(fboSupported)
     {
@@ -570,11 +1124,24 @@ int main(int argc, char **argv)
             fboUsed = false;
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if(fboUsed)
+        {
+            initBatchFBOs();
+            if((packreadback || outputyuv) && warpshaders)
+                initPackProgram();
+            initPackFBO();
+        }
     }
     
     //debug
     //fboUsed = 0;
     
+    if (outputyuv && !packProgram)
+    {
+		std::cout << "YUV output needs FBOs and the warp shaders, encoding BGR instead." << std::endl;
+		outputyuv = 0;
+	}
+    
     if (fboUsed)
     {
 		// for export
@@ -584,15 +1151,19 @@ int main(int argc, char **argv)
 		glPixelStorei(GL_PACK_ALIGNMENT, (dst.step & 3) ? 1 : 4);
 		//set length of one complete row in destination data (doesn't need to equal img.cols)
 		glPixelStorei(GL_PACK_ROW_LENGTH, dst.step/dst.elemSize());
+		initActiveRegion();
+		initReadbackPBOs();
 		
-		if (!(outputfourccstr[0] == 'N' &&
+		if (outputyuv && packfboId)
+			channels[0].yuvoutput = openY4M(outputbase + "W" + rangesuffix.str() + ".y4m", TEXTURE_WIDTH, TEXTURE_HEIGHT, inputfps);
+		else if (!(outputfourccstr[0] == 'N' &&
 				outputfourccstr[1] == 'U' &&
 				outputfourccstr[2] == 'L' &&
 				outputfourccstr[3] == 'L'))
         outputVideo.open(NAME, outputVideo.fourcc(outputfourccstr[0], outputfourccstr[1], outputfourccstr[2], outputfourccstr[3]), 
-        inputVideo.get(CAP_PROP_FPS), Size(TEXTURE_WIDTH,TEXTURE_HEIGHT), true);
+        inputfps, Size(TEXTURE_WIDTH,TEXTURE_HEIGHT), true);
 		else
-        outputVideo.open(NAME, ex, inputVideo.get(CAP_PROP_FPS), Size(TEXTURE_WIDTH,TEXTURE_HEIGHT), true);
+        outputVideo.open(NAME, ex, inputfps, Size(TEXTURE_WIDTH,TEXTURE_HEIGHT), true);
     
 	}
 	else
@@ -610,12 +1181,38 @@ int main(int argc, char **argv)
 				outputfourccstr[2] == 'L' &&
 				outputfourccstr[3] == 'L'))
         outputVideo.open(NAME, outputVideo.fourcc(outputfourccstr[0], outputfourccstr[1], outputfourccstr[2], outputfourccstr[3]), 
-        inputVideo.get(CAP_PROP_FPS), Size(SCREEN_WIDTH,SCREEN_HEIGHT), true);
+        inputfps, Size(SCREEN_WIDTH,SCREEN_HEIGHT), true);
 		else
-        outputVideo.open(NAME, ex, inputVideo.get(CAP_PROP_FPS), Size(SCREEN_WIDTH,SCREEN_HEIGHT), true);
+        outputVideo.open(NAME, ex, inputfps, Size(SCREEN_WIDTH,SCREEN_HEIGHT), true);
 	}
-	
-		
+
+	// the other channels are warped from the same upload, into their own FBOs
+	if (channels.size() > 1 && !fboUsed)
+	{
+		std::cout << "More channels need FBO support, rendering only " << strpathtowarpfile << std::endl;
+		channels.resize(1);
+	}
+	if (channels.size() > 1)
+	{
+		bool samecodec = outputfourccstr[0] == 'N' && outputfourccstr[1] == 'U' &&
+			outputfourccstr[2] == 'L' && outputfourccstr[3] == 'L';
+		int fourcc = samecodec ? ex : VideoWriter::fourcc(outputfourccstr[0], outputfourccstr[1], 
+			outputfourccstr[2], outputfourccstr[3]);
+		initChannels(outputbase + "W", rangesuffix.str(), fourcc, inputfps);
+	}
+
+	if (decodequeuedepth <= 0 && startframe && inputVideo.isOpened())
+		seekToFrame(inputVideo, startframe);
+	// from here on, only the decode thread reads from inputVideo
+	startDecoder();
+
+	if (!benchmode.empty())
+	{
+		runBenchmark();
+		exit(0);
+	}
+	if (previewframes <= 0 && previewms <= 0)
+		std::cout << "Preview is off, the window stays blank while rendering." << std::endl;
 
     // start timer
     timer.start();
@@ -667,27 +1264,38 @@ int initGLUT(int argc, char **argv)
 ///////////////////////////////////////////////////////////////////////////////
 void initGL()
 {
-    glShadeModel(GL_SMOOTH);                    // shading mathod: GL_SMOOTH or GL_FLAT
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);      // 4-byte pixel alignment
 
     // enable /disable features
-    glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
-    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
-    glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
     glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
     glEnable(GL_TEXTURE_2D);
     glEnable(GL_CULL_FACE);
 
-     // track material ambient and diffuse from surface color, call it before glEnable(GL_COLOR_MATERIAL)
-    glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
-    glEnable(GL_COLOR_MATERIAL);
-
     glClearColor(0, 0, 0, 0);                   // background color
     glClearStencil(0);                          // clear stencil buffer
     glClearDepth(1.0f);                         // 0 is near, 1 is far
     glDepthFunc(GL_LEQUAL);
 
+    // the warp shaders need none of the fixed function lighting
+    if (!warpshaders)
+        initFixedFunction();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// state for the fixed function warp, Warp_shaders = 0 or no GLSL
+///////////////////////////////////////////////////////////////////////////////
+void initFixedFunction()
+{
+    glShadeModel(GL_SMOOTH);                    // shading mathod: GL_SMOOTH or GL_FLAT
+    glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
+    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+    glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
+    glEnable(GL_LIGHTING);
+
+     // track material ambient and diffuse from surface color, call it before glEnable(GL_COLOR_MATERIAL)
+    glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+    glEnable(GL_COLOR_MATERIAL);
+
     initLights();
 }
 
@@ -763,6 +1371,8 @@ bool initSharedMem()
     drawMode = 0; // 0:fill, 1: wireframe, 2:points
 
     fboId = rboColorId = rboDepthId = fbotextureId = srctextureId = 0;
+    warpProgram = yuvProgram = frameProgram = 0;
+    yuvtextureIds[0] = yuvtextureIds[1] = yuvtextureIds[2] = 0;
     fboSupported = fboUsed = false;
     playTime = renderToTextureTime = 0;
 
@@ -776,19 +1386,70 @@ bool initSharedMem()
 ///////////////////////////////////////////////////////////////////////////////
 void clearSharedMem()
 {
+	stopDecoder();
+	flushReadbacks();
+	freeUploadSlots();
+	closeMappedInput();
+	freeChannels();
 	free(mesh);
     glDeleteTextures(1, &fbotextureId);
     glDeleteTextures(1, &srctextureId);
     srctextureId = fbotextureId = 0;
+    if(warpProgram)
+        glDeleteProgram(warpProgram);
+    if(yuvProgram)
+        glDeleteProgram(yuvProgram);
+    warpProgram = yuvProgram = 0;
+    glDeleteTextures(3, yuvtextureIds);
+    for (size_t t = 0; t < sourcetiles.size(); t++)
+    {
+        glDeleteTextures(1, &sourcetiles[t].textureId);
+        if(sourcetiles[t].vboId)
+            glDeleteBuffers(1, &sourcetiles[t].vboId);
+    }
+    sourcetiles.clear();
+    glDeleteTextures(1, &lutTextureId);
+    lutTextureId = 0;
+    if(lutquadvboId)
+        glDeleteBuffers(1, &lutquadvboId);
+    lutquadvboId = 0;
+    if(meshvboId)
+        glDeleteBuffers(1, &meshvboId);
+    if(meshiboId)
+        glDeleteBuffers(1, &meshiboId);
+    meshvboId = meshiboId = 0;
+    for(size_t k = 0; k < unpackpbofences.size(); k++)
+        if(unpackpbofences[k])
+            glDeleteSync(unpackpbofences[k]);
+    unpackpbofences.clear();
+    if(!unpackpboIds.empty())
+        glDeleteBuffers(unpackpboIds.size(), &unpackpboIds[0]);
+    unpackpboIds.clear();
+    freeReadbackPBOs();
 
     // clean up FBO, RBO
+    if(packProgram)
+        glDeleteProgram(packProgram);
+    packProgram = 0;
+    if(packquadvboId)
+        glDeleteBuffers(1, &packquadvboId);
+    packquadvboId = 0;
     if(fboSupported)
     {
+        freePackFBO();
+        freeBatchFBOs();
         glDeleteFramebuffers(1, &fboId);
         fboId = 0;
         glDeleteRenderbuffers(1, &rboDepthId);
         rboDepthId = 0;
     }
+    // finish the file here, rather than in the static destructors
+    outputVideo.release();
+    if (channels[0].yuvoutput)
+        closeY4M(channels[0].yuvoutput);
+    channels[0].yuvoutput = NULL;
+    if (duplicateframes)
+        std::cout << std::endl << duplicateframes << " duplicate frames reused the previous output.";
     std::cout << std::endl << "Finished writing." << std::endl;
 }
 
@@ -877,17 +1538,10 @@ void showInfo()
 
 
 ///////////////////////////////////////////////////////////////////////////////
-// display frame rates
+// display frame rates, as counted by countFPS()
 ///////////////////////////////////////////////////////////////////////////////
 void showFPS()
 {
-    static Timer timer;
-    static int count = 0;
-    static std::string fps = "0.0 FPS";
-    double elapsedTime = 0.0;;
-
-    ++count;
-
     // backup current model-view matrix
     glPushMatrix();                     // save current modelview matrix
     glLoadIdentity();                   // reset modelview matrix
@@ -900,27 +1554,38 @@ void showFPS()
 
     float color[4] = {1, 1, 0, 1};
 
-    // update fps every second
-    elapsedTime = timer.getElapsedTime();
+    int textWidth = (int)fpsstring.size() * TEXT_WIDTH;
+    drawString(fpsstring.c_str(), screenWidth-textWidth, screenHeight-TEXT_HEIGHT, color, font);
+
+    // restore projection matrix
+    glPopMatrix();                      // restore to previous projection matrix
+
+    // restore modelview matrix
+    glMatrixMode(GL_MODELVIEW);         // switch to modelview matrix
+    glPopMatrix();                      // restore to previous modelview matrix
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// counts the frames displayCB renders, on every call, whether the preview
+// is drawn or not, and updates the frame rate string once a second
+///////////////////////////////////////////////////////////////////////////////
+void countFPS(int frames)
+{
+    static Timer timer;
+    static int count = 0;
+
+    count += frames;
+    double elapsedTime = timer.getElapsedTime();
     if(elapsedTime >= 1.0)
     {
         std::stringstream ss;
         ss << std::fixed << std::setprecision(1);
         ss << (count / elapsedTime) << " FPS" << std::ends; // update fps string
         ss << std::resetiosflags(std::ios_base::fixed | std::ios_base::floatfield);
-        fps = ss.str();
+        fpsstring = ss.str();
         count = 0;                      // reset counter
         timer.start();                  // restart timer
     }
-    int textWidth = (int)fps.size() * TEXT_WIDTH;
-    drawString(fps.c_str(), screenWidth-textWidth, screenHeight-TEXT_HEIGHT, color, font);
-
-    // restore projection matrix
-    glPopMatrix();                      // restore to previous projection matrix
-
-    // restore modelview matrix
-    glMatrixMode(GL_MODELVIEW);         // switch to modelview matrix
-    glPopMatrix();                      // restore to previous modelview matrix
 }
 
 
@@ -1347,63 +2012,485 @@ void toPerspective()
 
 
 
-//=============================================================================
-// CALLBACKS
-//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// the warp, with generic attributes only: the mesh x,y are mapped by
+// a scale and offset (see setMeshOrtho), u,v and intensity passed on.
+///////////////////////////////////////////////////////////////////////////////
+const char *warpVertexShader =
+	"#version 120\n"
+	"attribute vec2 position;\n"
+	"attribute vec2 meshuv;\n"
+	"attribute vec3 intensity;\n"
+	"uniform vec4 ortho;\n"
+	"varying vec2 texcoord;\n"
+	"varying vec4 shade;\n"
+	"void main()\n"
+	"{\n"
+	"	texcoord = meshuv;\n"
+	"	shade = vec4(intensity, 1.0);\n"
+	"	gl_Position = vec4(position * ortho.xy + ortho.zw, 0.0, 1.0);\n"
+	"}\n";
 
-void displayCB()
-{
-    // get the total elapsed time
-    playTime = (float)timer.getElapsedTime();
+///////////////////////////////////////////////////////////////////////////////
+// renders the mesh u,v and intensity into the warp lookup texture
+///////////////////////////////////////////////////////////////////////////////
+const char *lutBuildFragmentShader =
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = vec4(texcoord, shade.r, 1.0);\n"
+	"}\n";
 
-    // compute rotation angle
-    const float ANGLE_SPEED = 90;   // degree/s
-    float angle = ANGLE_SPEED * playTime;
+///////////////////////////////////////////////////////////////////////////////
+// appended by linkProgram in lookup mode - fetches u,v and intensity of
+// this output pixel, leaves the pixels the mesh does not cover alone
+// like the mesh draw does, and runs the warp fragment shader
+///////////////////////////////////////////////////////////////////////////////
+const char *lutFragmentMain =
+	"#undef main\n"
+	"uniform sampler2D warplut;\n"
+	"uniform vec2 lutsize;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 lookup = texture2D(warplut, gl_FragCoord.xy / lutsize);\n"
+	"	if (lookup.a < 0.5)\n"
+	"		discard;\n"
+	"	texcoord = lookup.xy;\n"
+	"	shade = vec4(lookup.zzz, 1.0);\n"
+	"	warpMain();\n"
+	"}\n";
 
-    // render to texture //////////////////////////////////////////////////////
-    t1.start();
+///////////////////////////////////////////////////////////////////////////////
+// The fragment shaders below read the mesh u,v from texcoord and the
+// intensity from shade. linkProgram defines these as the varyings of
+// warpVertexShader, or as gl_TexCoord[0] and gl_Color when they are
+// used with the fixed function vertex pipeline.
+///////////////////////////////////////////////////////////////////////////////
+const char *plainFragmentShader =
+	"uniform sampler2D src;\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = texture2D(src, texcoord) * shade;\n"
+	"}\n";
 
-    // adjust viewport and projection matrix to texture dimension
-    glViewport(0, 0, TEXTURE_WIDTH, TEXTURE_HEIGHT);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(60.0f, (float)(TEXTURE_WIDTH)/TEXTURE_HEIGHT, 1.0f, 100.0f);
-    glMatrixMode(GL_MODELVIEW);
+///////////////////////////////////////////////////////////////////////////////
+// bicubic (Catmull-Rom) sampling of the source texture, for sourcescaling = 2.
+///////////////////////////////////////////////////////////////////////////////
+const char *bicubicFragmentShader =
+	"uniform sampler2D src;\n"
+	"uniform vec2 texsize;\n"
+	"vec4 weights(float t)\n"
+	"{\n"
+	"	float t2 = t*t, t3 = t2*t;\n"
+	"	return vec4(-0.5*t3 + t2 - 0.5*t, 1.5*t3 - 2.5*t2 + 1.0,\n"
+	"		-1.5*t3 + 2.0*t2 + 0.5*t, 0.5*t3 - 0.5*t2);\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 pos = texcoord * texsize - 0.5;\n"
+	"	vec2 base = floor(pos);\n"
+	"	vec4 wx = weights(pos.x - base.x);\n"
+	"	vec4 wy = weights(pos.y - base.y);\n"
+	"	vec4 sum = vec4(0.0);\n"
+	"	for (int j = 0; j < 4; j++)\n"
+	"		for (int i = 0; i < 4; i++)\n"
+	"			sum += wx[i] * wy[j] * texture2D(src, (base + vec2(i, j) - 0.5) / texsize);\n"
+	"	gl_FragColor = sum * shade;\n"
+	"}\n";
 
-    // camera transform
-    glLoadIdentity();
-    glTranslatef(0, 0, -CAMERA_DISTANCE);
 
-    // with FBO
-    // render directly to a texture
-    if(fboUsed)
-    {
-        // set the rendering destination to FBO
-        glBindFramebuffer(GL_FRAMEBUFFER, fboId);
 
-        // clear buffer
-        glClearColor(1, 1, 1, 1);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+///////////////////////////////////////////////////////////////////////////////
+// YUV 4:2:0 to RGB while sampling, for inputyuv. BT.601 limited range,
+// the same conversion as cvtColor and the ffmpeg backend would do.
+///////////////////////////////////////////////////////////////////////////////
+const char *yuvFragmentShader =
+	"uniform sampler2D ytex, utex, vtex;\n"
+	"uniform vec2 chromaoffset;\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 uv = texcoord;\n"
+	"	vec2 c = uv + chromaoffset;\n"
+	"	float y = 1.164 * (texture2D(ytex, uv).r - 16.0/255.0);\n"
+	"	vec2 chroma = vec2(texture2D(utex, c).r, texture2D(vtex, c).r);\n"
+	"	chroma -= 128.0/255.0;\n"
+	"	vec3 rgb = vec3(y + 1.596 * chroma.y,\n"
+	"		y - 0.391 * chroma.x - 0.813 * chroma.y,\n"
+	"		y + 2.018 * chroma.x);\n"
+	"	gl_FragColor = vec4(rgb, 1.0) * shade;\n"
+	"}\n";
 
-        // draw a rotating teapot at the origin
-        //~ glPushMatrix();
-        //~ glRotatef(angle*0.5f, 1, 0, 0);
-        //~ glRotatef(angle, 0, 1, 0);
-        //~ glRotatef(angle*0.7f, 0, 0, 1);
-        //~ glTranslatef(0, -1.575f, 0);
-        //~ drawTeapot();
-        //~ glPopMatrix();
-        
-        // draw frame from video onto texture
-        getNextFrame();
-        CreateGrid();
-        
-        glReadPixels(0, 0, TEXTURE_WIDTH, TEXTURE_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, dst.data);
-		//~ //glReadPixels(0,0,lpbih->biWidth,lpbih->biHeight,GL_BGR_EXT,GL_UNSIGNED_BYTE,bmBits);
-		//~ // GL_RGBA8 makes it much faster.
-		cvtColor(dst, dstbgr, CV_RGBA2BGR);
-		flip(dstbgr, flipped, 0);
-		outputVideo << flipped;
+///////////////////////////////////////////////////////////////////////////////
+// packs the RGBA output into BGR rows for the encoder, 4 bytes per texel
+// of a target 3/4 as wide, top row first. The output texels are sampled
+// at their centres, with the bias keeping to the base level.
+///////////////////////////////////////////////////////////////////////////////
+const char *packFragmentShader =
+	"uniform sampler2D warped;\n"
+	"uniform vec2 outputsize;\n"
+	"uniform bool fliprows;\n"
+	"float packedByte(float n, float row)\n"
+	"{\n"
+	"	float pixel = floor((n + 0.5) / 3.0);\n"
+	"	float channel = n - 3.0 * pixel;\n"
+	"	vec4 c = texture2D(warped, vec2(pixel + 0.5, row + 0.5) / outputsize, -16.0);\n"
+	"	return channel < 0.5 ? c.b : (channel < 1.5 ? c.g : c.r);\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"	float n = 4.0 * floor(gl_FragCoord.x);\n"
+	"	float row = floor(gl_FragCoord.y);\n"
+	"	if (fliprows)\n"
+	"		row = outputsize.y - 1.0 - row;\n"
+	"	gl_FragColor = vec4(packedByte(n, row), packedByte(n + 1.0, row),\n"
+	"		packedByte(n + 2.0, row), packedByte(n + 3.0, row));\n"
+	"}\n";
+
+///////////////////////////////////////////////////////////////////////////////
+// packs the RGBA output into I420 for Output_YUV, into a target of 1/4 the
+// width and 3/2 the height: the Y rows, then the U and then the V plane,
+// each row of those holding two rows of the half width plane, top row
+// first - a y4m frame as it is. BT.601 limited range, as the decoders
+// expect by default, with MPEG-2 chroma siting - co-sited with the left
+// luma sample of each pair, between the two rows.
+///////////////////////////////////////////////////////////////////////////////
+const char *yuvPackFragmentShader =
+	"uniform sampler2D warped;\n"
+	"uniform vec2 outputsize;\n"
+	"uniform bool fliprows;\n"
+	"vec3 rgbAt(float x, float y)\n"
+	"{\n"
+	"	if (fliprows)\n"
+	"		y = outputsize.y - 1.0 - y;\n"
+	"	return texture2D(warped, vec2(x + 0.5, y + 0.5) / outputsize, -16.0).rgb;\n"
+	"}\n"
+	"float luma(float x, float y)\n"
+	"{\n"
+	"	vec3 c = rgbAt(x, y);\n"
+	"	return (16.0 + 65.481 * c.r + 128.553 * c.g + 24.966 * c.b) / 255.0;\n"
+	"}\n"
+	"vec2 chroma(float n)\n"
+	"{\n"
+	"	float w = outputsize.x * 0.5;\n"
+	"	float y = floor((n + 0.5) / w);\n"
+	"	float x = 2.0 * (n - y * w);\n"
+	"	y *= 2.0;\n"
+	"	float left = max(x - 1.0, 0.0);\n"
+	"	vec3 c = (rgbAt(left, y) + 2.0 * rgbAt(x, y) + rgbAt(x + 1.0, y)\n"
+	"		+ rgbAt(left, y + 1.0) + 2.0 * rgbAt(x, y + 1.0) + rgbAt(x + 1.0, y + 1.0)) / 8.0;\n"
+	"	return vec2(128.0 - 37.797 * c.r - 74.203 * c.g + 112.0 * c.b,\n"
+	"		128.0 + 112.0 * c.r - 93.786 * c.g - 18.214 * c.b) / 255.0;\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"	float x = 4.0 * floor(gl_FragCoord.x);\n"
+	"	float row = floor(gl_FragCoord.y);\n"
+	"	if (row < outputsize.y)\n"
+	"	{\n"
+	"		gl_FragColor = vec4(luma(x, row), luma(x + 1.0, row), luma(x + 2.0, row), luma(x + 3.0, row));\n"
+	"		return;\n"
+	"	}\n"
+	"	row -= outputsize.y;\n"
+	"	float quarter = outputsize.y * 0.25;\n"
+	"	bool v = row >= quarter;\n"
+	"	if (v)\n"
+	"		row -= quarter;\n"
+	"	float n = row * outputsize.x + x;\n"
+	"	vec2 c0 = chroma(n), c1 = chroma(n + 1.0), c2 = chroma(n + 2.0), c3 = chroma(n + 3.0);\n"
+	"	gl_FragColor = v ? vec4(c0.y, c1.y, c2.y, c3.y) : vec4(c0.x, c1.x, c2.x, c3.x);\n"
+	"}\n";
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// compile a shader, printing the info log on failure
+// returns 0 if it could not be compiled
+///////////////////////////////////////////////////////////////////////////////
+GLuint compileShader(GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint status = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if(status == GL_FALSE)
+    {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        std::cout << "[ERROR] Shader compile failed: " << log << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// build a program from vertex and fragment shader sources
+// either may be NULL to use the fixed function stage instead
+// returns 0 if shaders are not supported or on errors
+// The fragment source gets the #version line, and texcoord and shade
+// to match the vertex stage used. The attributes of warpVertexShader
+// are bound to the locations drawMeshBuffers uses.
+// With lookup, texcoord and shade are read from the warp lookup texture
+// for each pixel instead, and the fragment shader's main is run after.
+///////////////////////////////////////////////////////////////////////////////
+GLuint linkProgram(const char *vertexsource, const char *fragmentsource, bool lookup)
+{
+#ifdef _WIN32
+    if(!glCreateShader || !glCreateProgram)
+        return 0;
+#endif
+
+    std::string fragment;
+    if(fragmentsource)
+    {
+        fragment = "#version 120\n";
+        if(lookup)
+            fragment += "vec2 texcoord;\nvec4 shade;\n#define main warpMain\n";
+        else if(vertexsource)
+            fragment += "varying vec2 texcoord;\nvarying vec4 shade;\n";
+        else
+            fragment += "#define texcoord gl_TexCoord[0].st\n#define shade gl_Color\n";
+        fragment += fragmentsource;
+        if(lookup)
+            fragment += lutFragmentMain;
+    }
+
+    GLuint program = glCreateProgram();
+    const char *sources[2] = { vertexsource, fragmentsource ? fragment.c_str() : NULL };
+    const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    for(int i = 0; i < 2; ++i)
+    {
+        if(!sources[i])
+            continue;
+        GLuint shader = compileShader(types[i], sources[i]);
+        if(!shader)
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        glAttachShader(program, shader);
+        glDeleteShader(shader);     // freed along with the program
+    }
+    if(vertexsource)
+    {
+        glBindAttribLocation(program, POSITION_ATTRIB, "position");
+        glBindAttribLocation(program, MESHUV_ATTRIB, "meshuv");
+        glBindAttribLocation(program, INTENSITY_ATTRIB, "intensity");
+    }
+    glLinkProgram(program);
+
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if(status == GL_FALSE)
+    {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cout << "[ERROR] Shader link failed: " << log << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// sets the ortho uniform of warpVertexShader for the current program.
+// Bourke's meshes have y from -1 to 1 over the output height, and x
+// from -aspect to aspect over its width, which is what the gluOrtho2D
+// in CreateGrid approximates through the perspective of the scene.
+// The mesh extents are checked against that, for meshes made for
+// another aspect ratio than the output, but the mapping is not fitted
+// to them: a mesh covering only part of the frame, like a fisheye
+// circle with cut corners, must stay where it is. initActiveRegion()
+// maps the mesh to pixels the same way.
+///////////////////////////////////////////////////////////////////////////////
+void setMeshOrtho(GLuint program, bool checkmesh)
+{
+	GLint location = glGetUniformLocation(program, "ortho");
+	if (location < 0)
+		return;		// fixed function vertex stage
+	float aspect = (float)TEXTURE_WIDTH / TEXTURE_HEIGHT;
+	float xmax = 0, ymax = 0;
+	for (int k = 0; checkmesh && k < meshrows * meshcolumns; k++)
+		if (mesh[k].i >= 0)
+		{
+			xmax = std::max(xmax, (float)fabs(mesh[k].x));
+			ymax = std::max(ymax, (float)fabs(mesh[k].y));
+		}
+	static bool warned = false;
+	if (!warned && (xmax > aspect * 1.01f || ymax > 1.01f))
+	{
+		std::cout << "The mesh reaches x " << xmax << ", y " << ymax << ", beyond the output of " 
+			<< aspect << " by 1, the outside is cut off." << std::endl;
+		warned = true;
+	}
+	glUniform4f(location, 1.0f / aspect, 1.0f, 0.0f, 0.0f);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// warp lookup texture - for meshes with about as many triangles as output
+// pixels, where drawing the mesh every frame costs more than it should.
+// The mesh is rendered once, at the output size, into an RGBA32F texture
+// of u, v, intensity and coverage, and each frame is then one quad over
+// the output whose fragment shader samples the source through it.
+// Warp_lookup_texture = 2 does this when the average triangle would be
+// smaller than 8 output pixels.
+///////////////////////////////////////////////////////////////////////////////
+void initWarpLUT()
+{
+	size_t triangles = meshindices.size() / 3;
+	if (warplut == 2 && triangles * 8 < (size_t)TEXTURE_WIDTH * TEXTURE_HEIGHT)
+		return;
+	GLuint buildProgram = linkProgram(warpVertexShader, lutBuildFragmentShader);
+	if (!buildProgram)
+	{
+		std::cout << "Lookup texture shader not available, drawing the mesh." << std::endl;
+		return;
+	}
+	
+	glGenTextures(1, &lutTextureId);
+	glBindTexture(GL_TEXTURE_2D, lutTextureId);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, TEXTURE_WIDTH, TEXTURE_HEIGHT, 0, GL_RGBA, GL_FLOAT, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	
+	GLuint lutfboId;
+	glGenFramebuffers(1, &lutfboId);
+	glBindFramebuffer(GL_FRAMEBUFFER, lutfboId);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lutTextureId, 0);
+	if (checkFramebufferStatus(lutfboId))
+	{
+		glViewport(0, 0, TEXTURE_WIDTH, TEXTURE_HEIGHT);
+		glClearColor(0, 0, 0, 0);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+		glUseProgram(buildProgram);
+		setMeshOrtho(buildProgram);
+		// from client memory, the mesh buffers do not exist yet
+		drawMeshBuffers(0, meshvertices.data(), meshindices.size(), 0, meshindices.data());
+		glUseProgram(0);
+		glEnable(GL_DEPTH_TEST);
+		glEnable(GL_CULL_FACE);
+		
+		// one quad over the whole output, in mesh coordinates
+		float aspect = (float)TEXTURE_WIDTH / TEXTURE_HEIGHT;
+		meshvertex corners[4] = { { -aspect, -1, 0, 0, 1, 1, 1 }, { aspect, -1, 0, 0, 1, 1, 1 },
+			{ aspect, 1, 0, 0, 1, 1, 1 }, { -aspect, 1, 0, 0, 1, 1, 1 } };
+		int order[6] = { 0, 1, 2, 0, 2, 3 };
+		lutquad.clear();
+		for (int k = 0; k < 6; k++)
+			lutquad.push_back(corners[order[k]]);
+		std::cout << "Warping through a lookup texture instead of drawing " 
+			<< triangles << " mesh triangles." << std::endl;
+	}
+	else
+	{
+		std::cout << "Float lookup texture not supported, drawing the mesh." << std::endl;
+		glDeleteTextures(1, &lutTextureId);
+		lutTextureId = 0;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &lutfboId);
+	glDeleteProgram(buildProgram);
+}
+
+void setLUTUniforms(GLuint program)
+{
+	if (!lutTextureId)
+		return;
+	glUniform1i(glGetUniformLocation(program, "warplut"), LUT_TEXTURE_UNIT);
+	glUniform2f(glGetUniformLocation(program, "lutsize"), (float)TEXTURE_WIDTH, (float)TEXTURE_HEIGHT);
+}
+
+
+
+//=============================================================================
+// CALLBACKS
+//=============================================================================
+
+void displayCB()
+{
+    // get the total elapsed time
+    playTime = (float)timer.getElapsedTime();
+
+    // compute rotation angle
+    const float ANGLE_SPEED = 90;   // degree/s
+    float angle = ANGLE_SPEED * playTime;
+
+    // the window is only refreshed as often as set in the ini file,
+    // the other frames are just warped, read back and encoded
+    bool preview = previewDue();
+    int frames = 0;     // rendered in this call, for countFPS
+
+    // render to texture //////////////////////////////////////////////////////
+    t1.start();
+
+    warpView();
+
+    // with FBO
+    // render directly to a texture
+    if(fboUsed)
+    {
+        // draw a rotating teapot at the origin
+        //~ glPushMatrix();
+        //~ glRotatef(angle*0.5f, 1, 0, 0);
+        //~ glRotatef(angle, 0, 1, 0);
+        //~ glRotatef(angle*0.7f, 0, 0, 1);
+        //~ glTranslatef(0, -1.575f, 0);
+        //~ drawTeapot();
+        //~ glPopMatrix();
+        
+        // draw the next batchframes frames from video, each into its
+        // own FBO, and only then read them back, so that the first
+        // glReadPixels waits for the whole batch at once.
+        // A repeated input frame is not warped again,
+        // the previous output is just written once more.
+        // At the end of the input, getNextFrame writes what is
+        // already in the batch before exiting.
+        // Each frame is uploaded once, and warped with the mesh of
+        // every channel.
+        while (batchcount < batchframes)
+        {
+            bool warped = getNextFrame();
+            frames++;
+            batchwarped[batchcount] = warped;
+            for (size_t c = 0; warped && c < channels.size(); c++)
+            {
+                useChannel(c);
+                // set the rendering destination to FBO
+                glBindFramebuffer(GL_FRAMEBUFFER, batchfboIds[batchcount]);
+                // for the size of this channel, and a fresh matrix for
+                // every frame, as the fixed function CreateGrid adds its
+                // gluOrtho2D to it
+                warpView();
+
+                // clear buffer
+                glClearColor(1, 1, 1, 1);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                CreateGrid();
+            }
+            batchcount++;
+        }
+        // the preview shows the last frame warped, and keeps the
+        // one before when the whole batch repeated it
+        for (int k = batchcount - 1; k >= 0; k--)
+            if (batchwarped[k])
+            {
+                previewslot = k;
+                break;
+            }
+        writeBatch();	// leaves channel 0 selected, for the preview
 
         // back to normal window-system-provided framebuffer
         glBindFramebuffer(GL_FRAMEBUFFER, 0); // unbind
@@ -1412,9 +2499,13 @@ void displayCB()
         // NOTE: If GL_GENERATE_MIPMAP is set to GL_TRUE, then glCopyTexSubImage2D()
         // triggers mipmap generation automatically. However, the texture attached
         // onto a FBO should generate mipmaps manually via glGenerateMipmap().
-        glBindTexture(GL_TEXTURE_2D, fbotextureId);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        // The other batch textures have only their base level.
+        if (preview && fbolevels > 1 && previewslot == 0)
+        {
+            glBindTexture(GL_TEXTURE_2D, fbotextureId);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
     }
 
     // without FBO
@@ -1439,20 +2530,32 @@ void displayCB()
         //~ glPopMatrix();
         
         // draw frame from video onto texture
-        getNextFrame();
-        CreateGrid();
-        
-        glReadPixels(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_BGRA, GL_UNSIGNED_BYTE, dst.data);
-		//glReadPixels(0,0,lpbih->biWidth,lpbih->biHeight,GL_BGR_EXT,GL_UNSIGNED_BYTE,bmBits);
-		// GL_BGRA makes it much faster.
-		cvtColor(dst, dstbgr, CV_BGRA2BGR);
-		flip(dstbgr, flipped, 0);
-		outputVideo << flipped;
-
-        // copy the framebuffer pixels to a texture
-        glBindTexture(GL_TEXTURE_2D, fbotextureId);
-        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, TEXTURE_WIDTH, TEXTURE_HEIGHT);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        // a repeated input frame is not warped again,
+        // the previous output is just written once more
+        frames = 1;
+        if (getNextFrame())
+        {
+            CreateGrid();
+            
+            glReadPixels(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_BGRA, GL_UNSIGNED_BYTE, dst.data);
+			//glReadPixels(0,0,lpbih->biWidth,lpbih->biHeight,GL_BGR_EXT,GL_UNSIGNED_BYTE,bmBits);
+			// GL_BGRA makes it much faster.
+			cvtColor(dst, dstbgr, CV_BGRA2BGR);
+			if (!flipinmesh)
+				flip(dstbgr, flipped, 0);
+
+            // copy the framebuffer pixels to a texture
+            if (preview)
+            {
+                glBindTexture(GL_TEXTURE_2D, fbotextureId);
+                glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, TEXTURE_WIDTH, TEXTURE_HEIGHT);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
+        }
+		if (flipinmesh)	// already top row first
+			outputVideo << dstbgr;
+		else
+			outputVideo << flipped;
 
         glPopAttrib(); // GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT
     }
@@ -1462,6 +2565,10 @@ void displayCB()
     renderToTextureTime = t1.getElapsedTimeInMilliSec();
     ///////////////////////////////////////////////////////////////////////////
 
+    countFPS(frames);
+    if (!preview)
+        return;
+
 
     // rendering as normal ////////////////////////////////////////////////////
 
@@ -1547,170 +2654,2612 @@ void mouseMotionCB(int x, int y)
 
 void exitCB()
 {
+    exiting = true;
     clearSharedMem();
 }
 
-void getNextFrame()
+///////////////////////////////////////////////////////////////////////////////
+// true when displayCB should refresh the preview window - every
+// previewframes frames, and whenever previewms have passed since the
+// last refresh. With both 0 the window is never drawn.
+///////////////////////////////////////////////////////////////////////////////
+bool previewDue()
 {
-	
-	glEnable(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, srctextureId);
-	// Capture next frame
-	inputVideo >> src; // gets the next frame into image
-	if (src.empty()) // end of video;
-	{
-		//onExitCleanup();
-		//clearSharedMem(); no need to call it, it is called as a callback
-		exit(0);
-	}
+    static long long untilnext = 0;
+    static Timer previewtimer;     // not started yet, so the first frame is shown
+    bool due = false;
+    if (previewframes > 0)
+    {
+        if (untilnext <= 0)
+        {
+            due = true;
+            untilnext = previewframes;
+        }
+        // each call renders a whole batch with an FBO
+        untilnext -= fboUsed ? batchframes : 1;
+    }
+    if (previewms > 0 && previewtimer.getElapsedTimeInMilliSec() >= previewms)
+        due = true;
+    if (due)
+        previewtimer.start();
+    return due;
+}
 
-	// update Texture
-	flip(src, flipped, 0);	// flip up down
-	resize(flipped, srcres, Size(texturew,textureh), 0, 0, INTER_CUBIC);
-	returncode = gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA8, srcres.cols, srcres.rows, GL_BGR, GL_UNSIGNED_BYTE, srcres.data);
-	if (returncode)	// if success, returncode=0
-		std::cout << "Errorcode for gluBuild2DMipmaps = " << returncode;
-	
-	
-	std::cout << "\x1B[0E"; // Move to the beginning of the current line.
-	fps++;
-	t_end = time(NULL);
-	if (t_end - t_start >= 5)
+///////////////////////////////////////////////////////////////////////////////
+// adds batchframes - 1 more FBOs of the output size, next to fboId.
+// They share its depth renderbuffer, and have their own colour textures
+// which are only read back. Stops at the first one which is incomplete.
+///////////////////////////////////////////////////////////////////////////////
+void initBatchFBOs()
+{
+	batchfboIds.assign(1, fboId);
+	batchtextureIds.clear();
+	for (int k = 1; k < batchframes; k++)
 	{
-		std::cout << "Frame: " << framenum++ << " fps: " << fps/5 <<  std::flush;
-		t_start = time(NULL);
-		fps = 0;
+		GLuint textureId, batchfboId;
+		glGenTextures(1, &textureId);
+		glBindTexture(GL_TEXTURE_2D, textureId);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, TEXTURE_WIDTH, TEXTURE_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		
+		glGenFramebuffers(1, &batchfboId);
+		glBindFramebuffer(GL_FRAMEBUFFER, batchfboId);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureId, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepthId);
+		bool status = checkFramebufferStatus(batchfboId);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!status)
+		{
+			glDeleteFramebuffers(1, &batchfboId);
+			glDeleteTextures(1, &textureId);
+			break;
+		}
+		batchfboIds.push_back(batchfboId);
+		batchtextureIds.push_back(textureId);
 	}
-	else
-	std::cout << "Frame: " << framenum++ << std::flush;
+	batchframes = batchfboIds.size();
+	batchwarped.assign(batchframes, false);
+	if (batchframes > 1 && currentchannel == 0)
+		std::cout << "Warping " << batchframes << " frames per batch before reading them back." << std::endl;
 }
 
-bool ReadMesh(std::string strpathtowarpfile)
+void freeBatchFBOs()
 {
-	//from https://github.com/hn-88/GL_warp2Avi/blob/master/GL2AviView.cpp
-	FILE *input = NULL;
-
-   input = fopen(strpathtowarpfile.c_str(), "r");
+	if (batchfboIds.size() > 1)
+		glDeleteFramebuffers(batchfboIds.size() - 1, &batchfboIds[1]);
+	if (!batchtextureIds.empty())
+		glDeleteTextures(batchtextureIds.size(), &batchtextureIds[0]);
+	batchfboIds.clear();
+	batchtextureIds.clear();
+}
 
-   /* Set rows and columns to 2 initially, as this is the size of the default mesh. */
-    int dummy, rows = 2, cols = 2;
+///////////////////////////////////////////////////////////////////////////////
+// reads back the batchcount frames warped since the last call, in order,
+// and writes them to the output of each channel. A frame which was not
+// warped, because its input repeated the previous one, is written as
+// the previous output.
+///////////////////////////////////////////////////////////////////////////////
+void writeBatch()
+{
+	if (batchcount == 0)
+		return;
+	if (!packpboIds.empty())
+	{
+		// written once the readback ring comes round to them
+		for (int k = 0; k < batchcount; k++)
+			queueReadback(batchwarped[k] ? k : -1);
+		batchcount = 0;
+		return;
+	}
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		useChannel(c);
+		for (int k = 0; k < batchcount; k++)
+		{
+			if (batchwarped[k] && packfboId)
+				readBatchFrame(k, dstbgr.data);	// BGR or I420, top row first
+			else if (batchwarped[k])
+			{
+				readBatchFrame(k, dst.data);
+				//~ //glReadPixels(0,0,lpbih->biWidth,lpbih->biHeight,GL_BGR_EXT,GL_UNSIGNED_BYTE,bmBits);
+				//~ // GL_RGBA8 makes it much faster.
+				convertActive(dst);
+			}
+			if (flipinmesh || packfboId)	// already top row first
+				writeFrame(c, dstbgr);
+			else
+				writeFrame(c, flipped);
+		}
+	}
+	useChannel(0);
+	batchcount = 0;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    if (input != NULL)  {
-		fscanf(input, " %d %d %d ", &dummy, &cols, &rows) ;
-		float x, y, u, v, l;
-		meshrows=rows;
-		meshcolumns=cols;
+///////////////////////////////////////////////////////////////////////////////
+// asynchronous readback, through a ring of pixel pack buffers. glReadPixels
+// into a buffer returns at once, and the frame is only mapped and written
+// when its buffer is needed again, readbackpbos frames later, by when the
+// GPU has long finished it. Each channel has its own ring, of its size,
+// and the frames in flight are in pendingreadbacks, oldest first.
+///////////////////////////////////////////////////////////////////////////////
+void initReadbackPBOs()
+{
+	packpboIds.clear();
+	if (readbackpbos <= 0 || !pboSupported)
+		return;
+	// with fewer, the last frames of a batch would wait for its first
+	if (readbackpbos <= batchframes)
+		readbackpbos = batchframes + 1;
+	packpboIds.resize(readbackpbos);
+	glGenBuffers(readbackpbos, &packpboIds[0]);
+	// only the active bands are read back, the rest keeps the background
+	std::vector<uchar> background(dst.total() * dst.elemSize(), 255);
+	if (packfboId)
+		std::copy(dstbgr.data, dstbgr.data + dstbgr.total() * dstbgr.elemSize(), background.begin());
+	for (int k = 0; k < readbackpbos; k++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, packpboIds[k]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, background.size(), &background[0], GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (currentchannel == 0)
+		std::cout << "Reading frames back through " << readbackpbos << " pixel buffer objects." << std::endl;
+}
 
-		// the following is adapted from the code at
-		// http://paulbourke.net/dataformats/meshwarp/
+void freeReadbackPBOs()
+{
+	if (!packpboIds.empty())
+		glDeleteBuffers(packpboIds.size(), &packpboIds[0]);
+	packpboIds.clear();
+}
 
+///////////////////////////////////////////////////////////////////////////////
+// starts reading back frame batchframe of the batch FBOs, in every channel,
+// or just keeps the place of a repeated frame when batchframe is -1
+///////////////////////////////////////////////////////////////////////////////
+void queueReadback(int batchframe)
+{
+	if (batchframe < 0)
+	{
+		// written again with the frame it repeats, which is still in
+		// flight - the ring is only emptied at the end
+		if (!pendingreadbacks.empty())
+			pendingreadbacks.back().repeats++;
+		return;
+	}
+	if ((int)pendingreadbacks.size() >= readbackpbos)
+		finishReadback();
+	PendingReadback readback = { packpboIndex, 0, 0 };
+	packpboIndex = (packpboIndex + 1) % readbackpbos;
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		useChannel(c);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, packpboIds[readback.pbo]);
+		readBatchFrame(batchframe, 0);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	useChannel(0);
+	if (syncSupported)
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	pendingreadbacks.push_back(readback);
+}
 
-		mesh		= (meshpoint*)calloc(rows*cols, sizeof(meshpoint));
-		 
-		//  (meshpoint*) explicit cast required for c++
-		//	  have to do an explicit cast
-		// since this is C++ and not C
-	// http://cboard.cprogramming.com/windows-programming/69549-%27initializing%27-cannot-convert-%27void-*%27-%27int-*%27.html
+///////////////////////////////////////////////////////////////////////////////
+// writes the oldest frame in flight to the output of each channel.
+// Without fences, mapping the buffer waits for the transfer instead.
+///////////////////////////////////////////////////////////////////////////////
+void finishReadback()
+{
+	PendingReadback readback = pendingreadbacks.front();
+	pendingreadbacks.pop_front();
+	if (readback.fence)
+	{
+		glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+		glDeleteSync(readback.fence);
+	}
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		useChannel(c);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, packpboIds[readback.pbo]);
+		uchar *mapped = (uchar *)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		if (mapped)
+		{
+			Mat frame;
+			if (packfboId)	// top row first, encoded from the buffer itself
+				frame = packedFrame(mapped);
+			else
+				frame = convertActive(Mat(TEXTURE_HEIGHT, TEXTURE_WIDTH, CV_8UC4, mapped));
+			for (int r = 0; r <= readback.repeats; r++)
+				writeFrame(c, frame);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	useChannel(0);
+}
 
+void flushReadbacks()
+{
+	while (!pendingreadbacks.empty())
+		finishReadback();
+}
 
-	     for (int r = 0; r < rows ; r++) {
-             for (int c = 0; c < cols ; c++) {
-		                
-                fscanf(input, "%f %f %f %f %f", &x, &y, &u, &v, &l) ;                 
-                //   using the code adapted from 
-				// http://paulbourke.net/dataformats/meshwarp/
-				// and from vlc-warp
-				//   We pack the values for each node into a 1d array.  
-    
-                mesh[cols*r+c].x = x;
-                mesh[cols*r+c].y = y;
-                mesh[cols*r+c].u = u;
-                mesh[cols*r+c].v = v;
-                mesh[cols*r+c].i = l;
- 
-				
+///////////////////////////////////////////////////////////////////////////////
+// reads frame batchframe of the batch FBOs into pixels, a client pointer or
+// an offset into the bound pixel pack buffer. With a pack FBO, as BGR rows
+// or I420, top row first, ready for the encoder, otherwise RGBA as rendered.
+// Only the active bands are read, each to its place in the whole frame.
+///////////////////////////////////////////////////////////////////////////////
+void readBatchFrame(int batchframe, uchar *pixels)
+{
+	if (packfboId)
+	{
+		int packw, packh;
+		packSize(packw, packh);
+		packBatchFrame(batchframe);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glPixelStorei(GL_PACK_ROW_LENGTH, packw);
+		// packed rows are output rows, 4 pixels in 3 texels as BGR,
+		// or in 1 as luma
+		int texels = outputyuv ? 1 : 3;
+		size_t rowbytes = packw * 4;
+		for (size_t b = 0; b < activebands.size(); b++)
+		{
+			const Rect &band = activebands[b];
+			glReadPixels(band.x * texels / 4, band.y, band.width * texels / 4, band.height, 
+				GL_RGBA, GL_UNSIGNED_BYTE, pixels + band.y * rowbytes + band.x * texels);
+		}
+		if (outputyuv)	// the chroma planes, whole
+			glReadPixels(0, TEXTURE_HEIGHT, packw, packh - TEXTURE_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, 
+				pixels + TEXTURE_HEIGHT * rowbytes);
+	}
+	else
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, batchfboIds[batchframe]);
+		glPixelStorei(GL_PACK_ALIGNMENT, (dst.step & 3) ? 1 : 4);
+		glPixelStorei(GL_PACK_ROW_LENGTH, dst.step/dst.elemSize());
+		for (size_t b = 0; b < activebands.size(); b++)
+		{
+			Rect band = renderedBand(activebands[b]);
+			glReadPixels(band.x, band.y, band.width, band.height, GL_RGBA, GL_UNSIGNED_BYTE, 
+				pixels + band.y * dst.step + band.x * dst.elemSize());
+		}
+	}
+}
 
+///////////////////////////////////////////////////////////////////////////////
+// the part of the output the mesh covers - for fisheye masters, a circle
+// in a square, and for flat screens often less than the frame. The rows
+// are spanned by the bounding boxes of the valid quads, with a pixel to
+// spare, and grouped in bands of ACTIVE_BAND_ROWS rows with the widest
+// span of their rows, so that each band is one glReadPixels. Band edges
+// are on multiples of 4 pixels, whole texels of the pack FBO.
+// The frame outside the bands is never read back, so dstbgr and flipped
+// are filled with the background once, as displayCB clears the FBOs.
+///////////////////////////////////////////////////////////////////////////////
+void initActiveRegion()
+{
+	int w = TEXTURE_WIDTH, h = TEXTURE_HEIGHT;
+	activebands.assign(1, Rect(0, 0, w, h));
+	// without the warp shaders, the mesh is not mapped as setMeshOrtho does
+	if (activeregion && warpshaders)
+	{
+		std::vector<int> left(h, w), right(h, 0);
+		float scale = h * 0.5f;		// pixels per mesh unit
+		int nx = meshcolumns;
+		for (int j = 0; j < meshrows - 1; j++)
+			for (int i = 0; i < nx - 1; i++)
+			{
+				int corners[4] = { nx*j+i, nx*j+i+1, nx*(j+1)+i, nx*(j+1)+i+1 };
+				float xmin = w, xmax = 0, ymin = h, ymax = 0;
+				bool valid = true;
+				for (int k = 0; k < 4; k++)
+				{
+					const meshpoint &p = mesh[corners[k]];
+					valid = valid && p.i >= 0;
+					float x = p.x * scale + w * 0.5f;
+					float y = (flipinmesh ? 1 + p.y : 1 - p.y) * scale;	// output row
+					xmin = std::min(xmin, x);
+					xmax = std::max(xmax, x);
+					ymin = std::min(ymin, y);
+					ymax = std::max(ymax, y);
+				}
+				if (!valid)
+					continue;
+				int x0 = std::max((int)floor(xmin) - 1, 0) & ~3;
+				int x1 = std::min(((int)ceil(xmax) + 4) & ~3, w);
+				int y0 = std::max((int)floor(ymin) - 1, 0);
+				int y1 = std::min((int)ceil(ymax) + 1, h);
+				for (int y = y0; y < y1; y++)
+				{
+					left[y] = std::min(left[y], x0);
+					right[y] = std::max(right[y], x1);
+				}
 			}
-			 
+		activebands.clear();
+		size_t area = 0;
+		for (int start = 0; start < h; start += ACTIVE_BAND_ROWS)
+		{
+			int x0 = w, x1 = 0, y0 = h, y1 = 0;
+			for (int y = start; y < std::min(start + ACTIVE_BAND_ROWS, h); y++)
+				if (left[y] < right[y])
+				{
+					x0 = std::min(x0, left[y]);
+					x1 = std::max(x1, right[y]);
+					y0 = std::min(y0, y);
+					y1 = y + 1;
+				}
+			if (x0 >= x1)
+				continue;
+			area += (size_t)(x1 - x0) * (y1 - y0);
+			if (!activebands.empty() && activebands.back().x == x0 && activebands.back().width == x1 - x0
+				&& activebands.back().y + activebands.back().height == y0)
+				activebands.back().height += y1 - y0;
+			else
+				activebands.push_back(Rect(x0, y0, x1 - x0, y1 - y0));
 		}
+		if (currentchannel == 0)
+			std::cout << "Reading back " << (int)(100.0 * area / ((size_t)w * h) + 0.5) 
+				<< "% of the output, the part the mesh covers, in " 
+				<< activebands.size() << " bands." << std::endl;
 	}
-	else // unable to read mesh
+	if (packfboId && outputyuv)		// white, as I420
 	{
-		std::cout << "Unable to read mesh data file (similar to EP_xyuv_1920.map), exiting!" << std::endl;
-		//onExitCleanup();
-		//clearSharedMem(); no need to explicitly call it.
-		exit(0);
+		dstbgr.rowRange(0, h).setTo(Scalar::all(235));
+		dstbgr.rowRange(h, dstbgr.rows).setTo(Scalar::all(128));
+	}
+	else
+	{
+		dstbgr.create(h, w, CV_8UC3);
+		dstbgr.setTo(Scalar::all(255));
+		flipped = dstbgr.clone();
 	}
 }
-		
 
-void CreateGrid()
+// a band of the output, in the rows of the FBO as glReadPixels returns them
+Rect renderedBand(const Rect &band)
 {
-	// Set Projection Matrix
-	//~ glMatrixMode (GL_PROJECTION);
+	Rect rendered = band;
+	if (!flipinmesh)
+		rendered.y = TEXTURE_HEIGHT - band.y - band.height;
+	return rendered;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// converts the active bands of an RGBA frame, as read back, into dstbgr
+// and, unless the mesh was flipped, flips them into flipped.
+// Returns the one which is now the output frame, top row first.
+///////////////////////////////////////////////////////////////////////////////
+Mat convertActive(const Mat &rgba)
+{
+	for (size_t b = 0; b < activebands.size(); b++)
+	{
+		Rect rendered = renderedBand(activebands[b]);
+		Mat bgr = dstbgr(rendered);
+		cvtColor(rgba(rendered), bgr, CV_RGBA2BGR);
+		if (!flipinmesh)
+		{
+			Mat out = flipped(activebands[b]);
+			flip(bgr, out, 0);
+		}
+	}
+	return flipinmesh ? dstbgr : flipped;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// the pack pass - packFragmentShader over a quad covering the pack FBO,
+// which stays bound for the readback
+///////////////////////////////////////////////////////////////////////////////
+void initPackProgram()
+{
+	packProgram = linkProgram(warpVertexShader, outputyuv ? yuvPackFragmentShader : packFragmentShader);
+	if (!packProgram)
+	{
+		std::cout << "Pack shader not available, converting to BGR on the CPU." << std::endl;
+		return;
+	}
+	if (outputyuv)
+		std::cout << "Converting the output to I420 on the GPU, written as y4m." << std::endl;
+	glUseProgram(packProgram);
+	glUniform1i(glGetUniformLocation(packProgram, "warped"), 0);
+	glUniform4f(glGetUniformLocation(packProgram, "ortho"), 1.0f, 1.0f, 0.0f, 0.0f);	// quad in clip space
+	glUseProgram(0);
+	meshvertex corners[4] = { { -1, -1, 0, 0, 1, 1, 1 }, { 1, -1, 0, 0, 1, 1, 1 },
+		{ 1, 1, 0, 0, 1, 1, 1 }, { -1, 1, 0, 0, 1, 1, 1 } };
+	int order[6] = { 0, 1, 2, 0, 2, 3 };
+	packquad.clear();
+	for (int k = 0; k < 6; k++)
+		packquad.push_back(corners[order[k]]);
+	uploadMeshBuffers(packquadvboId, packquad, NULL, NULL);
+}
+
+void initPackFBO()
+{
+	packfboId = packtextureId = 0;
+	if (!packProgram)
+		return;
+	int packw, packh;
+	if (!packSize(packw, packh))
+	{
+		std::cout << "Output size " << TEXTURE_WIDTH << "x" << TEXTURE_HEIGHT 
+			<< " does not divide into the pack target, converting to BGR on the CPU." << std::endl;
+		return;
+	}
+	glGenTextures(1, &packtextureId);
+	glBindTexture(GL_TEXTURE_2D, packtextureId);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, packw, packh, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glGenFramebuffers(1, &packfboId);
+	glBindFramebuffer(GL_FRAMEBUFFER, packfboId);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, packtextureId, 0);
+	bool status = checkFramebufferStatus(packfboId);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!status)
+	{
+		freePackFBO();
+		return;
+	}
+	// read back into directly
+	if (outputyuv)
+		dstbgr.create(packh, TEXTURE_WIDTH, CV_8UC1);
+	else
+		dstbgr.create(TEXTURE_HEIGHT, TEXTURE_WIDTH, CV_8UC3);
+	if (currentchannel == 0 && !outputyuv)
+		std::cout << "Packing the output to BGR on the GPU." << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// size of the pack target, in RGBA texels. False if the output size does
+// not fit it: BGR rows must be whole texels, and for I420 also the rows
+// of the half size planes, two to a row.
+///////////////////////////////////////////////////////////////////////////////
+bool packSize(int &w, int &h)
+{
+	if (outputyuv)
+	{
+		w = TEXTURE_WIDTH / 4;
+		h = TEXTURE_HEIGHT * 3 / 2;
+		return TEXTURE_WIDTH % 8 == 0 && TEXTURE_HEIGHT % 4 == 0;
+	}
+	w = TEXTURE_WIDTH * 3 / 4;
+	h = TEXTURE_HEIGHT;
+	return TEXTURE_WIDTH % 4 == 0;
+}
+
+// Mat header for a packed frame, as it was read back
+Mat packedFrame(uchar *data)
+{
+	if (outputyuv)
+		return Mat(TEXTURE_HEIGHT * 3 / 2, TEXTURE_WIDTH, CV_8UC1, data);
+	return Mat(TEXTURE_HEIGHT, TEXTURE_WIDTH, CV_8UC3, data);
+}
+
+void freePackFBO()
+{
+	if (packfboId)
+		glDeleteFramebuffers(1, &packfboId);
+	glDeleteTextures(1, &packtextureId);
+	packfboId = packtextureId = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// y4m output, for Output_YUV - a file, or piped into yuvcommand with %s
+// replaced by the output name without the extension
+///////////////////////////////////////////////////////////////////////////////
+FILE *openY4M(const std::string &name, int w, int h, double fps)
+{
+	FILE *file;
+	std::string target = name;
+	if (yuvcommand == "NONE")
+		file = fopen(name.c_str(), "wb");
+	else
+	{
+		target = yuvcommand;
+		size_t at = target.find("%s");
+		if (at != std::string::npos)
+			target.replace(at, 2, name.substr(0, name.find_last_of('.')));
+#ifdef _WIN32
+		file = _popen(target.c_str(), "wb");
+#else
+		// a command which exits early then fails the write, see
+		// writeFrame, instead of killing the process
+		signal(SIGPIPE, SIG_IGN);
+		file = popen(target.c_str(), "w");
+#endif
+	}
+	if (!file)
+	{
+		std::cout << "Could not open " << target << " for the y4m output, exiting!" << std::endl;
+		exit(1);
+	}
+	int fpsnum = (int)(fps * 1000 + 0.5);
+	if (fpsnum <= 0)
+		fpsnum = 25000;
+	fprintf(file, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C420mpeg2\n", w, h, fpsnum);
+	return file;
+}
+
+void closeY4M(FILE *file)
+{
+	if (yuvcommand == "NONE")
+		fclose(file);
+	else
+#ifdef _WIN32
+		_pclose(file);	// waits for the command to finish
+#else
+		pclose(file);	// waits for the command to finish
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// to the VideoWriter of channel c, or its y4m output. A failed y4m write,
+// a full disk or an encoder which has died on the pipe, ends the run.
+///////////////////////////////////////////////////////////////////////////////
+void writeFrame(size_t c, const Mat &frame)
+{
+	FILE *file = channels[c].yuvoutput;
+	if (file)
+	{
+		size_t bytes = frame.total() * frame.elemSize();
+		if (fputs("FRAME\n", file) == EOF || fwrite(frame.data, 1, bytes, file) != bytes)
+		{
+			std::cout << std::endl << "Writing the y4m output of channel " << c << " failed, exiting!" << std::endl;
+			channels[c].yuvoutput = NULL;
+			closeY4M(file);
+			if (!exiting)
+				exit(1);
+		}
+	}
+	else if (channels[c].output)
+		*channels[c].output << frame;
+}
+
+void packBatchFrame(int batchframe)
+{
+	int packw, packh;
+	packSize(packw, packh);
+	glBindFramebuffer(GL_FRAMEBUFFER, packfboId);
+	glViewport(0, 0, packw, packh);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glUseProgram(packProgram);
+	glUniform2f(glGetUniformLocation(packProgram, "outputsize"), (float)TEXTURE_WIDTH, (float)TEXTURE_HEIGHT);
+	glUniform1i(glGetUniformLocation(packProgram, "fliprows"), !flipinmesh);
+	glBindTexture(GL_TEXTURE_2D, batchframe ? batchtextureIds[batchframe - 1] : fbotextureId);
+	drawMeshBuffers(packquadvboId, packquad.data(), packquad.size(), 0, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glViewport(0, 0, TEXTURE_WIDTH, TEXTURE_HEIGHT);	// for the next warp
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// multiple channels, each with its own mesh, output size, FBOs and file,
+// warped from the same source texture. The globals hold the state of the
+// selected channel, useChannel() exchanges them with the WarpChannel of
+// another, so that everything else works on one channel as before.
+///////////////////////////////////////////////////////////////////////////////
+void swapChannel(WarpChannel &channel)
+{
+	std::swap(TEXTURE_WIDTH, channel.width);
+	std::swap(TEXTURE_HEIGHT, channel.height);
+	std::swap(mesh, channel.mesh);
+	std::swap(meshrows, channel.meshrows);
+	std::swap(meshcolumns, channel.meshcolumns);
+	std::swap(meshvertices, channel.meshvertices);
+	std::swap(meshindices, channel.meshindices);
+	std::swap(meshvboId, channel.meshvboId);
+	std::swap(meshiboId, channel.meshiboId);
+	std::swap(lutTextureId, channel.lutTextureId);
+	std::swap(lutquadvboId, channel.lutquadvboId);
+	std::swap(lutquad, channel.lutquad);
+	std::swap(sourcetiles, channel.sourcetiles);
+	std::swap(fboId, channel.fboId);
+	std::swap(fbotextureId, channel.fbotextureId);
+	std::swap(rboDepthId, channel.rboDepthId);
+	std::swap(batchfboIds, channel.batchfboIds);
+	std::swap(batchtextureIds, channel.batchtextureIds);
+	std::swap(packpboIds, channel.packpboIds);
+	std::swap(packfboId, channel.packfboId);
+	std::swap(packtextureId, channel.packtextureId);
+	std::swap(dst, channel.dst);
+	std::swap(dstbgr, channel.dstbgr);
+	std::swap(flipped, channel.flipped);
+	std::swap(activebands, channel.activebands);
+}
+
+void useChannel(size_t c)
+{
+	if (c == currentchannel)
+		return;
+	swapChannel(channels[currentchannel]);	// back where it came from
+	swapChannel(channels[c]);
+	currentchannel = c;
+	// the shaders are shared, only the output aspect and lookup texture
+	// size change, and the lookup texture is bound to the same unit
+	WarpChannel &channel = channels[c];
+	GLuint programs[2] = { warpProgram, yuvProgram };
+	for (int p = 0; p < 2; p++)
+		if (programs[p])
+		{
+			if (channel.uniformprograms[p] != programs[p])
+			{
+				channel.uniformprograms[p] = programs[p];
+				channel.orthoLocation[p] = glGetUniformLocation(programs[p], "ortho");
+				channel.lutsizeLocation[p] = glGetUniformLocation(programs[p], "lutsize");
+			}
+			glUseProgram(programs[p]);
+			if (channel.orthoLocation[p] >= 0)	// as setMeshOrtho
+				glUniform4f(channel.orthoLocation[p], (float)TEXTURE_HEIGHT / TEXTURE_WIDTH, 1.0f, 0.0f, 0.0f);
+			if (lutTextureId)
+				glUniform2f(channel.lutsizeLocation[p], (float)TEXTURE_WIDTH, (float)TEXTURE_HEIGHT);
+			glUseProgram(0);
+		}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GPU side of channels 1 and up, as main does it for channel 0 - lookup
+// texture, mesh buffers, the mesh clipped to the source tiles, FBOs and
+// the output file, named namestart + suffix + nameend and the extension.
+///////////////////////////////////////////////////////////////////////////////
+void initChannels(const std::string &namestart, const std::string &nameend, int fourcc, double fps)
+{
+	bool lookup = lutTextureId != 0;	// as the shaders were linked for channel 0
+	for (size_t c = 1; c < channels.size(); c++)
+	{
+		useChannel(c);
+		if (lookup)
+		{
+			int keep = warplut;
+			warplut = 1;
+			initWarpLUT();
+			warplut = keep;
+		}
+		uploadMeshBuffers(meshvboId, meshvertices, &meshiboId, &meshindices);
+		if (lutTextureId)
+			uploadMeshBuffers(lutquadvboId, lutquad, NULL, NULL);
+		// the tile textures of channel 0, with this mesh clipped to them
+		sourcetiles = channels[0].sourcetiles;
+		for (size_t t = 0; t < sourcetiles.size(); t++)
+		{
+			SourceTile &tile = sourcetiles[t];
+			tile.triangles.clear();
+			clipMeshToTile(tile, tile.u0, tile.u1, tile.v0, tile.v1);
+			uploadMeshBuffers(tile.vboId, tile.triangles, NULL, NULL);
+		}
+		
+		// only read back, never previewed, so no mipmaps
+		glGenTextures(1, &fbotextureId);
+		glBindTexture(GL_TEXTURE_2D, fbotextureId);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, TEXTURE_WIDTH, TEXTURE_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenRenderbuffers(1, &rboDepthId);
+		glBindRenderbuffer(GL_RENDERBUFFER, rboDepthId);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, TEXTURE_WIDTH, TEXTURE_HEIGHT);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glGenFramebuffers(1, &fboId);
+		glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fbotextureId, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepthId);
+		bool status = checkFramebufferStatus(fboId);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!status)
+		{
+			std::cout << "Could not create the FBO of channel " << c << ", rendering only the channels before it." << std::endl;
+			useChannel(0);
+			channels.resize(c);
+			break;
+		}
+		initBatchFBOs();
+		initPackFBO();
+		
+		dst.create(TEXTURE_HEIGHT, TEXTURE_WIDTH, CV_8UC4);	// (rows, columns, type)
+		initActiveRegion();
+		initReadbackPBOs();
+		std::string name = namestart + channels[c].suffix + nameend;
+		if (outputyuv && packfboId)
+			channels[c].yuvoutput = openY4M(name += ".y4m", TEXTURE_WIDTH, TEXTURE_HEIGHT, fps);
+		else
+		{
+			channels[c].output = new VideoWriter();
+			channels[c].output->open(name += ".avi", fourcc, fps, Size(TEXTURE_WIDTH, TEXTURE_HEIGHT), true);
+		}
+		std::cout << "Channel " << c << " warps with " << channels[c].warpfile << " into " 
+			<< name << ", " << TEXTURE_WIDTH << "x" << TEXTURE_HEIGHT << std::endl;
+	}
+	useChannel(0);
+}
+
+void freeChannels()
+{
+	for (size_t c = 1; c < channels.size(); c++)
+	{
+		useChannel(c);
+		free(mesh);
+		mesh = NULL;
+		glDeleteTextures(1, &lutTextureId);
+		if(lutquadvboId)
+			glDeleteBuffers(1, &lutquadvboId);
+		if(meshvboId)
+			glDeleteBuffers(1, &meshvboId);
+		if(meshiboId)
+			glDeleteBuffers(1, &meshiboId);
+		// the tile textures belong to channel 0
+		for (size_t t = 0; t < sourcetiles.size(); t++)
+			if(sourcetiles[t].vboId)
+				glDeleteBuffers(1, &sourcetiles[t].vboId);
+		freeReadbackPBOs();
+		if(fboId)
+		{
+			freePackFBO();
+			freeBatchFBOs();
+			glDeleteFramebuffers(1, &fboId);
+			glDeleteRenderbuffers(1, &rboDepthId);
+			glDeleteTextures(1, &fbotextureId);
+		}
+		if (channels[c].output)
+		{
+			channels[c].output->release();
+			delete channels[c].output;
+		}
+		if (channels[c].yuvoutput)
+			closeY4M(channels[c].yuvoutput);
+	}
+	useChannel(0);
+	channels.resize(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// viewport and projection matrix for the warp pass
+///////////////////////////////////////////////////////////////////////////////
+void warpView()
+{
+    // adjust viewport and projection matrix to texture dimension
+    glViewport(0, 0, TEXTURE_WIDTH, TEXTURE_HEIGHT);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(60.0f, (float)(TEXTURE_WIDTH)/TEXTURE_HEIGHT, 1.0f, 100.0f);
+    glMatrixMode(GL_MODELVIEW);
+
+    // camera transform
+    glLoadIdentity();
+    glTranslatef(0, 0, -CAMERA_DISTANCE);
+}
+
+bool getNextFrame()
+{
+	bool duplicate = false;
+	
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, srctextureId);
+	// Capture next frame
+	if (!readNextFrame(duplicate)) // end of video;
+	{
+		//onExitCleanup();
+		//clearSharedMem(); no need to call it, it is called as a callback
+		writeBatch();	// the frames warped before this one
+		flushReadbacks();
+		exit(0);
+	}
+
+	// update Texture
+	if (duplicate)
+		duplicateframes++;	// the texture still holds this frame
+	else
+		uploadFrame();
+	
+	
+	std::cout << "\x1B[0E"; // Move to the beginning of the current line.
+	fps++;
+	t_end = time(NULL);
+	if (t_end - t_start >= 5)
+	{
+		std::cout << "Frame: " << framenum++ << " fps: " << fps/5 <<  std::flush;
+		t_start = time(NULL);
+		fps = 0;
+	}
+	else
+	std::cout << "Frame: " << framenum++ << std::flush;
+	return !duplicate;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// gets the next input frame into srcres, ready for uploadFrame().
+// duplicate is set, and srcres left as it was, if the frame repeats
+// the previous one. Returns false at the end of the input or range.
+// Does not touch GL, so that the decode benchmark can use it.
+///////////////////////////////////////////////////////////////////////////////
+bool readNextFrame(bool &duplicate)
+{
+	duplicate = false;
+	if (mappedinput.base)
+	{
+		// a Mat header pointing straight into the mapped file,
+		// uploaded from there without copies when no resize is needed
+		if (nextframeout >= decodeendframe)
+			return false;
+		Mat frame = mappedFrame(nextframeout++);
+		prefetchMappedFrames(nextframeout, 4);
+		if (skipduplicates && isDuplicateFrame(frame))
+			duplicate = true;
+		else if (mappedinput.yuv && !inputyuv)
+		{
+			cvtColor(frame, src, COLOR_YUV2BGR_I420);
+			prepareFrame(src, srcres);
+		}
+		else
+			prepareFrame(frame, srcres);
+	}
+	else if (decodequeuedepth > 0)
+	{
+		// already prepared by the decode thread
+		if (!popFrame(srcres))
+		{
+			if (decodeFailed)
+			{
+				std::cout << std::endl << "No decode thread could open the input video, exiting!" << std::endl;
+				exit(1);
+			}
+			return false;
+		}
+		// the slot of the frame before is only handed back after the
+		// compare, which reads it through prevframe
+		int previousslot = holdSlot(srcres);
+		duplicate = skipduplicates && isDuplicateFrame(srcres);
+		releaseSlot(previousslot);
+	}
+	else
+	{
+		if (nextframeout >= decodeendframe) // end of range
+			return false;
+		if (skipduplicates)	// prevframe still refers to src, don't decode over it
+			src.release();
+		inputVideo >> src; // gets the next frame into image
+		if (src.empty()) // end of video;
+			return false;
+		nextframeout++;
+		duplicate = skipduplicates && isDuplicateFrame(src);
+		if (!duplicate)
+			prepareFrame(src, srcres);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// uploads srcres to the source texture, which must be bound
+///////////////////////////////////////////////////////////////////////////////
+void uploadFrame()
+{
+	frameProgram = warpProgram;
+	if (isYUVFrame(srcres))
+		uploadYUV(srcres);
+	else
+	{
+		// srcres is already texturew x textureh, so just replace
+		// the contents of the texture allocated at startup
+		const uchar *pixels = beginUpload(srcres);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, (srcres.step & 3) ? 1 : 4);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, srcres.step/srcres.elemSize());
+		if (sourcetiles.empty())
+		{
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, srcres.cols, srcres.rows, GL_BGR, GL_UNSIGNED_BYTE, pixels);
+			if (sourcelevels > 1)
+				glGenerateMipmap(GL_TEXTURE_2D);
+		}
+		else
+		{
+			// each tile takes its rectangle, borders included, out of the frame
+			for (size_t t = 0; t < sourcetiles.size(); t++)
+			{
+				SourceTile &tile = sourcetiles[t];
+				glBindTexture(GL_TEXTURE_2D, tile.textureId);
+				glPixelStorei(GL_UNPACK_SKIP_PIXELS, tile.x);
+				glPixelStorei(GL_UNPACK_SKIP_ROWS, tile.y);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tile.w, tile.h, GL_BGR, GL_UNSIGNED_BYTE, pixels);
+				if (sourcelevels > 1)
+					glGenerateMipmap(GL_TEXTURE_2D);
+			}
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+			glBindTexture(GL_TEXTURE_2D, srctextureId);
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		endUpload();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// prints frames/s and ms/frame for one benchmark stage
+///////////////////////////////////////////////////////////////////////////////
+void printBenchStage(const char *stage, double ms, int frames)
+{
+	if (frames <= 0)
+		return;
+	std::cout << stage << ": " << frames << " frames, "
+		<< frames * 1000.0 / ms << " frames/s, "
+		<< ms / frames << " ms/frame" << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// --bench runs one stage of displayCB on its own, benchframes times,
+// with the real input and mesh, to show which stage limits a render.
+// decode: reads, resizes and flips frames as for rendering, and drops them.
+// warp: uploads and warps the first frame over and over, and reads it back
+//       as the render does, with glFinish between the steps so that each
+//       can be timed.
+// encode: warps the first frame once and writes it benchframes times,
+//         to the output file with _bench appended to its name.
+///////////////////////////////////////////////////////////////////////////////
+void runBenchmark()
+{
+	Timer stagetimer;
+	bool duplicate;
+	int frames = 0;
+	std::cout << "Benchmarking " << benchmode << " for " << benchframes << " frames" << std::endl;
+
+	if (benchmode == "decode")
+	{
+		int duplicates = 0;
+		stagetimer.start();
+		while (frames < benchframes && readNextFrame(duplicate))
+		{
+			frames++;
+			if (duplicate)
+				duplicates++;
+		}
+		stagetimer.stop();
+		printBenchStage("decode", stagetimer.getElapsedTimeInMilliSec(), frames);
+		if (duplicates)
+			std::cout << duplicates << " of these were duplicates, which skip the resize." << std::endl;
+		return;
+	}
+
+	if (!readNextFrame(duplicate))
+	{
+		std::cout << "No input frame to benchmark with." << std::endl;
+		return;
+	}
+	glEnable(GL_TEXTURE_2D);
+
+	// one warp and readback of the frame, timing each step. With FBOs,
+	// read back as writeBatch does: the active bands, packed on the GPU
+	// and through the readback PBOs when those are on, and converted on
+	// the CPU only without the pack FBO.
+	double uploadms = 0, warpms = 0, readms = 0, convertms = 0;
+	int warps = benchmode == "warp" ? benchframes : 1;
+	for (frames = 0; frames < warps; frames++)
+	{
+		// the pack pass leaves its own FBO and no texture bound
+		if (fboUsed)
+			glBindFramebuffer(GL_FRAMEBUFFER, batchfboIds[0]);
+		glBindTexture(GL_TEXTURE_2D, srctextureId);
+		// every time, as the fixed function CreateGrid adds its
+		// gluOrtho2D to the matrix
+		warpView();
+		stagetimer.start();
+		uploadFrame();
+		glFinish();
+		stagetimer.stop();
+		uploadms += stagetimer.getElapsedTimeInMilliSec();
+
+		stagetimer.start();
+		glClearColor(1, 1, 1, 1);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		CreateGrid();
+		glFinish();
+		stagetimer.stop();
+		warpms += stagetimer.getElapsedTimeInMilliSec();
+
+		if (!fboUsed)
+		{
+			stagetimer.start();
+			glReadPixels(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_BGRA, GL_UNSIGNED_BYTE, dst.data);
+			stagetimer.stop();
+			readms += stagetimer.getElapsedTimeInMilliSec();
+
+			stagetimer.start();
+			cvtColor(dst, dstbgr, CV_BGRA2BGR);
+			if (!flipinmesh)
+				flip(dstbgr, flipped, 0);
+			stagetimer.stop();
+			convertms += stagetimer.getElapsedTimeInMilliSec();
+			continue;
+		}
+		
+		uchar *mapped = NULL;
+		stagetimer.start();
+		if (!packpboIds.empty())
+		{
+			// mapping waits for the transfer, which the render
+			// overlaps with the next frames
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, packpboIds[0]);
+			readBatchFrame(0, 0);
+			mapped = (uchar *)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		}
+		else
+			readBatchFrame(0, packfboId ? dstbgr.data : dst.data);
+		glFinish();
+		stagetimer.stop();
+		readms += stagetimer.getElapsedTimeInMilliSec();
+
+		if (!packfboId)
+		{
+			stagetimer.start();
+			convertActive(mapped ? Mat(TEXTURE_HEIGHT, TEXTURE_WIDTH, CV_8UC4, mapped) : dst);
+			stagetimer.stop();
+			convertms += stagetimer.getElapsedTimeInMilliSec();
+		}
+		else if (mapped)	// for the encode stage, not timed
+			packedFrame(mapped).copyTo(dstbgr);
+		if (!packpboIds.empty())
+		{
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+	}
+	if (fboUsed)
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (benchmode == "warp")
+	{
+		printBenchStage("upload", uploadms, frames);
+		printBenchStage("warp", warpms, frames);
+		printBenchStage(packfboId ? "pack and readback" : "readback", readms, frames);
+		if (!packfboId)
+			printBenchStage("convert and flip", convertms, frames);
+		printBenchStage("total", uploadms + warpms + readms + convertms, frames);
+		return;
+	}
+
+	// encode, into the output main opened, the frame as writeBatch
+	// writes it - BGR or I420 from the pack FBO, top row first
+	Mat out = (flipinmesh || packfboId) ? dstbgr : flipped;
+	FILE *yuvoutput = channels[0].yuvoutput;
+	stagetimer.start();
+	for (frames = 0; frames < benchframes; frames++)
+		writeFrame(0, out);
+	// include flushing the encoder
+	if (yuvoutput)
+	{
+		channels[0].yuvoutput = NULL;
+		closeY4M(yuvoutput);	// waits for Output_YUV_command
+	}
+	else
+		outputVideo.release();
+	stagetimer.stop();
+	printBenchStage("encode", stagetimer.getElapsedTimeInMilliSec(), frames);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// hash of a frame, for spotting repeated frames cheaply.
+// Only hashes 64 rows spread over the frame, 8 bytes at a time,
+// with the xxHash64 round and avalanche.
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long frameHash(const Mat &frame)
+{
+	const unsigned long long prime1 = 11400714785074694791ULL;
+	const unsigned long long prime2 = 14029467366897019727ULL;
+	const unsigned long long prime3 = 1609587929392839161ULL;
+	size_t rowbytes = frame.cols * frame.elemSize();
+	int rowstep = frame.rows > 64 ? frame.rows / 64 : 1;
+	unsigned long long h = prime3 + rowbytes + frame.rows;
+	for (int row = 0; row < frame.rows; row += rowstep)
+	{
+		const uchar *p = frame.ptr(row);
+		size_t i = 0;
+		for (; i + 8 <= rowbytes; i += 8)
+		{
+			unsigned long long word;
+			memcpy(&word, p + i, 8);
+			word *= prime2;
+			word = (word << 31) | (word >> 33);
+			word *= prime1;
+			h ^= word;
+			h = ((h << 27) | (h >> 37)) * prime1 + prime3;
+		}
+		for (; i < rowbytes; i++)
+		{
+			h ^= p[i] * prime1;
+			h = ((h << 11) | (h >> 53)) * prime2;
+		}
+	}
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// true if frame has the same contents as the previous frame given here.
+// A matching hash is confirmed with a full compare, so that a change
+// outside the sampled rows is never dropped. Keeps a reference to the
+// frame for the next call.
+///////////////////////////////////////////////////////////////////////////////
+bool isDuplicateFrame(const Mat &frame)
+{
+	unsigned long long hash = frameHash(frame);
+	bool same = !prevframe.empty() && hash == prevframehash
+		&& prevframe.rows == frame.rows && prevframe.cols == frame.cols && prevframe.type() == frame.type();
+	if (same)
+	{
+		size_t rowbytes = frame.cols * frame.elemSize();
+		for (int row = 0; row < frame.rows && same; row++)
+			same = memcmp(prevframe.ptr(row), frame.ptr(row), rowbytes) == 0;
+	}
+	prevframe = frame;
+	prevframehash = hash;
+	return same;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// flip and resize a decoded frame, ready for uploading as texture
+// called from the decode thread, so it must not touch GL or the globals
+// used by displayCB.
+// With flipinmesh the mesh v is already inverted, so a native size
+// frame is used as it is, without any copy.
+///////////////////////////////////////////////////////////////////////////////
+void prepareFrame(const Mat &in, Mat &out)
+{
+	if (isYUVFrame(in))
+	{
+		out = in;
+		return;
+	}
+	if (flipinmesh)
+	{
+		if (in.cols == texturew && in.rows == textureh)
+			out = in;
+		else
+			resize(in, out, Size(texturew,textureh), 0, 0, INTER_CUBIC);
+		return;
+	}
+	if (in.cols == texturew && in.rows == textureh)
+	{
+		flip(in, out, 0);	// flip up down, no resize needed
+		return;
+	}
+	Mat flippedin;
+	flip(in, flippedin, 0);	// flip up down
+	resize(flippedin, out, Size(texturew,textureh), 0, 0, INTER_CUBIC);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decode thread - keeps up to queuewindow frames ready in frameQueue
+// so that decoding overlaps with the warp and readback in displayCB.
+// Segments are handed out in order, so with several threads each one
+// decodes every decodethreads'th segment, seeking over the others.
+///////////////////////////////////////////////////////////////////////////////
+void decodeLoop(int thread)
+{
+	VideoCapture segmentcapture;
+	VideoCapture *capture = &inputVideo;
+	if (decodethreads > 1)
+	{
+		// the threads all open the input at once, which a busy disk or
+		// network share may refuse for a moment
+		for (int tries = 0; tries < 3 && !segmentcapture.isOpened(); tries++)
+		{
+			if (tries)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			segmentcapture.open(inputfilename);
+		}
+		if (!segmentcapture.isOpened())
+		{
+			// segments are taken in turn, so the other threads decode
+			// this one's share too. Only when none of them could open the
+			// input is the decode ended, as failed, for readNextFrame.
+			std::cout << "Decode thread " << thread << " could not open the input video, " 
+				<< "continuing with the others." << std::endl;
+			std::lock_guard<std::mutex> lock(queueMutex);
+			if (++decodeopenfailures == decodethreads)
+			{
+				decodeFailed = true;
+				decodeendframe = nextframeout;
+				queueNotEmpty.notify_one();
+			}
+			return;
+		}
+		if (inputyuv)
+			segmentcapture.set(CAP_PROP_CONVERT_RGB, 0);
+		capture = &segmentcapture;
+	}
+	
+	unsigned long long pos = 0;		// frame the capture will deliver next
+	unsigned long long start, end;
+	while (nextSegment(start, end))
+	{
+		if (start != pos)
+		{
+			if (!seekToFrame(*capture, start))
+			{
+				finishDecode(start);
+				return;
+			}
+			pos = start;
+		}
+		
+		for (; pos < end; pos++)
+		{
+			// a new Mat for every frame, since prepareFrame may pass
+			// it on as it is, and displayCB may still be using it.
+			// With upload slots, the decoder writes straight into the
+			// slot when the frame needs no resize.
+			Mat slot = acquireSlot();
+			Mat decoded = slot;
+			*capture >> decoded;
+			if (decoded.empty()) // end of video
+			{
+				releaseSlot(slotOf(slot));
+				finishDecode(pos);
+				return;
+			}
+			
+			Mat prepared = prepareIntoSlot(decoded, slot);
+			if (!pushFrame(pos, prepared))
+				return;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// image sequence decode thread - images decode independently, so each
+// thread just takes the next frame number and reads that file
+///////////////////////////////////////////////////////////////////////////////
+void decodeImages(int thread)
+{
+	unsigned long long frame, end;
+	while (nextSegment(frame, end))
+	{
+		Mat decoded = imread(sequencefiles[frame], IMREAD_COLOR);
+		if (decoded.empty())
+		{
+			std::cout << std::endl << "Decode thread " << thread << " could not read " 
+				<< sequencefiles[frame] << ", stopping there." << std::endl;
+			finishDecode(frame);
+			return;
+		}
+		Mat slot = acquireSlot();
+		Mat prepared = prepareIntoSlot(decoded, slot);
+		if (!pushFrame(frame, prepared))
+			return;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// seek so that the next frame read is the given one.
+// The FFmpeg backend seeks to the keyframe before it and decodes forward;
+// if a backend lands after the frame instead, start again from the
+// beginning and skip forward, which is slow but exact. startDecoder
+// checks for this once, so that only a single seek ever does it.
+///////////////////////////////////////////////////////////////////////////////
+bool seekToFrame(VideoCapture &capture, unsigned long long frame)
+{
+	capture.set(CAP_PROP_POS_FRAMES, (double)frame);
+	double landed = capture.get(CAP_PROP_POS_FRAMES);
+	if (landed < 0 || landed > frame)
+	{
+		capture.set(CAP_PROP_POS_FRAMES, 0);
+		landed = 0;
+	}
+	for (unsigned long long skip = (unsigned long long)landed; skip < frame; skip++)
+		if (!capture.grab())
+			return false;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// opens the input once more and seeks a segment ahead, to see whether
+// the backend lands on or before the frame asked for. If it does not,
+// every segment seek would decode again from the start of the file.
+///////////////////////////////////////////////////////////////////////////////
+bool seekLandsExactly()
+{
+	VideoCapture probe(inputfilename);
+	if (!probe.isOpened())
+		return true;	// the decode threads report this
+	unsigned long long frame = nextsegmentstart + segmentframes;
+	probe.set(CAP_PROP_POS_FRAMES, (double)frame);
+	double landed = probe.get(CAP_PROP_POS_FRAMES);
+	return landed >= 0 && landed <= frame;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// hands the next segment of frames to a decode thread
+// returns false when there is nothing more to decode
+///////////////////////////////////////////////////////////////////////////////
+bool nextSegment(unsigned long long &start, unsigned long long &end)
+{
+	std::lock_guard<std::mutex> lock(queueMutex);
+	if (decodeStop || nextsegmentstart >= decodeendframe)
+		return false;
+	start = nextsegmentstart;
+	end = start + segmentframes;
+	nextsegmentstart = end;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// adds a frame to the queue, waiting while it is too far ahead of displayCB
+// returns false if the decoder is being stopped
+///////////////////////////////////////////////////////////////////////////////
+bool pushFrame(unsigned long long frame, const Mat &prepared)
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+	queueNotFull.wait(lock, [frame]{ return decodeStop || frame < nextframeout + queuewindow; });
+	if (decodeStop)
+		return false;
+	frameQueue[frame] = prepared;
+	queueNotEmpty.notify_one();
+	return true;
+}
+
+void finishDecode(unsigned long long endframe)
+{
+	std::lock_guard<std::mutex> lock(queueMutex);
+	if (endframe < decodeendframe)
+		decodeendframe = endframe;
+	queueNotEmpty.notify_one();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// returns the next frame, in order, waiting if it is not ready yet
+// returns false at the end of the video
+///////////////////////////////////////////////////////////////////////////////
+bool popFrame(Mat &frame)
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+	queueNotEmpty.wait(lock, []{ return nextframeout >= decodeendframe || frameQueue.count(nextframeout); });
+	if (nextframeout >= decodeendframe)
+		return false;
+	frame = frameQueue[nextframeout];
+	frameQueue.erase(nextframeout);
+	nextframeout++;
+	// several threads may be waiting for different frames
+	queueNotFull.notify_all();
+	return true;
+}
+
+void startDecoder()
+{
+	if (decodequeuedepth <= 0)
+		return;
+	if (!sequencefiles.empty())
+	{
+		// one image at a time for each thread
+		decodethreads = imagethreads;
+		segmentframes = 1;
+	}
+	if (decodethreads < 1)
+		decodethreads = 1;
+	if (segmentframes < 1)
+		segmentframes = 1;
+	if (decodethreads > 1 && sequencefiles.empty() && !seekLandsExactly())
+	{
+		std::cout << "Seeking in the input is not exact, decoding it with a single thread." << std::endl;
+		decodethreads = 1;
+	}
+	
+	// every thread needs room for a whole segment ahead of displayCB,
+	// otherwise the later segments would just wait for the earlier ones
+	queuewindow = decodequeuedepth;
+	if (decodethreads > 1 && queuewindow < (unsigned long long)decodethreads * segmentframes)
+		queuewindow = (unsigned long long)decodethreads * segmentframes;
+	
+	std::cout << "Decoding with " << decodethreads << " thread(s), up to " 
+		<< queuewindow << " frames ahead." << std::endl;
+	initUploadSlots();
+	for (int i = 0; i < decodethreads; i++)
+		if (sequencefiles.empty())
+			decodeThreads.push_back(std::thread(decodeLoop, i));
+		else
+			decodeThreads.push_back(std::thread(decodeImages, i));
+}
+
+void stopDecoder()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		decodeStop = true;
+		frameQueue.clear();
+	}
+	queueNotFull.notify_all();
+	for (size_t i = 0; i < decodeThreads.size(); i++)
+		if (decodeThreads[i].joinable())
+			decodeThreads[i].join();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// image sequence input - a directory, a printf style pattern like
+// shot_%05d.png, or any one numbered image of the sequence
+///////////////////////////////////////////////////////////////////////////////
+bool isImageFile(const std::string &name)
+{
+	static const char *extensions[] = { "png", "tif", "tiff", "jpg", "jpeg", "bmp", 
+		"exr", "webp", "jp2", "ppm", "pgm", "hdr" };
+	std::string::size_type dot = name.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string ext = name.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+		if (ext == extensions[i])
+			return true;
+	return false;
+}
+
+bool isDirectory(const std::string &name)
+{
+	struct stat info;
+	return stat(name.c_str(), &info) == 0 && (info.st_mode & S_IFDIR);
+}
+
+bool fileExists(const std::string &name)
+{
+	struct stat info;
+	return stat(name.c_str(), &info) == 0;
+}
+
+bool isImageSequence(const std::string &input)
+{
+	std::string prefix, suffix;
+	int digits;
+	return isDirectory(input) || parseSequencePattern(input, prefix, digits, suffix) || isImageFile(input);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// splits a printf style pattern with a single %d or %0Nd, and no other %,
+// into the parts around the frame number. Anything else is not a pattern,
+// so a file named like 100%_final.mp4 is opened as it is.
+///////////////////////////////////////////////////////////////////////////////
+bool parseSequencePattern(const std::string &input, std::string &prefix, int &digits, std::string &suffix)
+{
+	std::string::size_type percent = input.find('%');
+	if (percent == std::string::npos || input.find('%', percent + 1) != std::string::npos)
+		return false;
+	std::string::size_type pos = percent + 1;
+	digits = 0;
+	if (pos < input.size() && input[pos] == '0')
+	{
+		pos++;
+		std::string::size_type widthstart = pos;
+		while (pos < input.size() && isdigit(input[pos]))
+			digits = digits * 10 + (input[pos++] - '0');
+		if (pos == widthstart || digits > 18)
+			return false;
+	}
+	if (pos >= input.size() || input[pos] != 'd')
+		return false;
+	prefix = input.substr(0, percent);
+	suffix = input.substr(pos + 1);
+	return true;
+}
+
+// the file of frame number, zero padded to digits
+std::string sequenceFileName(const std::string &prefix, int digits, const std::string &suffix, unsigned long long number)
+{
+	std::stringstream ss;
+	ss << prefix << std::setw(digits) << std::setfill('0') << number << suffix;
+	return ss.str();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// splits a file name at its last run of digits, the frame number
+// returns false if the name, without its directory, has no digits
+///////////////////////////////////////////////////////////////////////////////
+bool splitFrameNumber(const std::string &name, std::string &prefix, std::string &number, std::string &suffix)
+{
+	std::string::size_type slash = name.find_last_of("/\\");
+	std::string::size_type start = (slash == std::string::npos) ? 0 : slash + 1;
+	std::string::size_type last = name.find_last_of("0123456789");
+	if (last == std::string::npos || last < start)
+		return false;
+	std::string::size_type first = last;
+	while (first > start && isdigit(name[first-1]))
+		first--;
+	prefix = name.substr(0, first);
+	number = name.substr(first, last - first + 1);
+	suffix = name.substr(last + 1);
+	return true;
+}
+
+// the names of the files in dir, without the directory
+void listDirectory(const std::string &dir, std::vector<std::string> &names)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA finddata;
+	HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &finddata);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+			names.push_back(finddata.cFileName);
+		while (FindNextFileA(find, &finddata));
+		FindClose(find);
+	}
+#else
+	DIR *d = opendir(dir.c_str());
+	if (d)
+	{
+		struct dirent *entry;
+		while ((entry = readdir(d)) != NULL)
+			names.push_back(entry->d_name);
+		closedir(d);
+	}
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// fills sequencefiles with the frames in order
+// returns false if there are none
+///////////////////////////////////////////////////////////////////////////////
+bool listImageSequence(const std::string &input, std::string &outputbase)
+{
+	sequencefiles.clear();
+#ifdef _WIN32
+	const char separator = '\\';
+#else
+	const char separator = '/';
+#endif
+	
+	if (isDirectory(input))
+	{
+		std::string dir = input;
+		while (dir.size() > 1 && (dir[dir.size()-1] == '/' || dir[dir.size()-1] == '\\'))
+			dir.erase(dir.size() - 1);
+		outputbase = dir;
+		std::vector<std::string> names;
+		listDirectory(dir, names);
+		
+		// the first numbered image by name sets the prefix and suffix,
+		// other images in the directory are not frames of the sequence.
+		// Frame numbers need not be zero padded, so sort by the number.
+		std::sort(names.begin(), names.end());
+		std::vector<std::pair<unsigned long long, std::string> > frames;
+		std::vector<std::string> unnumbered;
+		std::string firstprefix, firstsuffix;
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			if (!isImageFile(names[i]))
+				continue;
+			std::string prefix, number, suffix;
+			if (!splitFrameNumber(names[i], prefix, number, suffix))
+			{
+				unnumbered.push_back(dir + separator + names[i]);
+				continue;
+			}
+			if (frames.empty())
+			{
+				firstprefix = prefix;
+				firstsuffix = suffix;
+			}
+			else if (prefix != firstprefix || suffix != firstsuffix)
+				continue;
+			frames.push_back(std::make_pair(strtoull(number.c_str(), NULL, 10), dir + separator + names[i]));
+		}
+		std::sort(frames.begin(), frames.end());
+		for (size_t i = 0; i < frames.size(); i++)
+			sequencefiles.push_back(frames[i].second);
+		if (frames.empty())
+			sequencefiles = unnumbered;	// no numbers, so in name order
+		return !sequencefiles.empty();
+	}
+	
+	std::string prefix, suffix;
+	int digits;
+	unsigned long long number = 0;
+	if (parseSequencePattern(input, prefix, digits, suffix))
+	{
+		// the sequence may start at any number, so look for the lowest
+		// one in the directory, written exactly as the pattern would
+		std::string::size_type slash = prefix.find_last_of("/\\");
+		std::string dirpart = (slash == std::string::npos) ? "" : prefix.substr(0, slash + 1);
+		std::vector<std::string> names;
+		listDirectory(dirpart.empty() ? std::string(".") : dirpart.substr(0, dirpart.size() - 1), names);
+		bool found = false;
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			std::string name = dirpart + names[i];
+			if (name.size() <= prefix.size() + suffix.size() || 
+				name.compare(0, prefix.size(), prefix) != 0 || 
+				name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+				continue;
+			std::string numberpart = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+			if (numberpart.size() > 19 || numberpart.find_first_not_of("0123456789") != std::string::npos)
+				continue;
+			unsigned long long candidate = strtoull(numberpart.c_str(), NULL, 10);
+			if (sequenceFileName(prefix, digits, suffix, candidate) != name)
+				continue;
+			if (!found || candidate < number)
+				number = candidate;
+			found = true;
+		}
+		outputbase = prefix;
+		if (!found)
+			return false;
+	}
+	else
+	{
+		// the picked file starts the sequence
+		std::string numberpart;
+		if (!splitFrameNumber(input, prefix, numberpart, suffix))
+		{
+			sequencefiles.push_back(input);		// a single image
+			outputbase = input.substr(0, input.find_last_of('.'));
+			return true;
+		}
+		digits = numberpart.size();
+		number = strtoull(numberpart.c_str(), NULL, 10);
+		outputbase = prefix;
+	}
+	
+	for (; ; number++)
+	{
+		std::string name = sequenceFileName(prefix, digits, suffix, number);
+		if (!fileExists(name))
+			break;
+		sequencefiles.push_back(name);
+	}
+	return !sequencefiles.empty();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// memory mapped input, for uncompressed .y4m (4:2:0) and raw .bgr/.raw
+// files of rawwidth x rawheight BGR24 frames. Frames are Mat headers
+// pointing into the mapping, so nothing is copied before the upload.
+///////////////////////////////////////////////////////////////////////////////
+bool isMappedInput(const std::string &name)
+{
+	std::string::size_type dot = name.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string ext = name.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext == "y4m" || ext == "bgr" || ext == "raw";
+}
+
+bool openMappedInput(const std::string &name)
+{
+#ifdef _WIN32
+	mappedinput.file = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, 
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	LARGE_INTEGER filesize;
+	if (mappedinput.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(mappedinput.file, &filesize))
+	{
+		std::cout << "Could not open the input file: " << name << std::endl;
+		return false;
+	}
+	mappedinput.size = (size_t)filesize.QuadPart;
+	mappedinput.mapping = CreateFileMappingA(mappedinput.file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappedinput.mapping)
+		mappedinput.base = (unsigned char *)MapViewOfFile(mappedinput.mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	mappedinput.fd = open(name.c_str(), O_RDONLY);
+	struct stat info;
+	if (mappedinput.fd < 0 || fstat(mappedinput.fd, &info) != 0)
+	{
+		std::cout << "Could not open the input file: " << name << std::endl;
+		return false;
+	}
+	mappedinput.size = info.st_size;
+	void *mapped = mmap(NULL, mappedinput.size, PROT_READ, MAP_SHARED, mappedinput.fd, 0);
+	if (mapped != MAP_FAILED)
+	{
+		mappedinput.base = (unsigned char *)mapped;
+		madvise(mapped, mappedinput.size, MADV_SEQUENTIAL);
+	}
+#endif
+	if (!mappedinput.base)
+	{
+		std::cout << "Could not map the input file: " << name << std::endl;
+		return false;
+	}
+	
+	std::string ext = name.substr(name.find_last_of('.') + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	if (ext != "y4m")
+	{
+		// raw BGR24, size from the ini file
+		mappedinput.yuv = false;
+		mappedinput.width = rawwidth;
+		mappedinput.height = rawheight;
+		mappedinput.fps = sequencefps;
+		mappedinput.framebytes = (size_t)rawwidth * rawheight * 3;
+		for (size_t offset = 0; offset + mappedinput.framebytes <= mappedinput.size; offset += mappedinput.framebytes)
+			mappedinput.frameoffsets.push_back(offset);
+		return !mappedinput.frameoffsets.empty();
+	}
+	
+	// YUV4MPEG2 header, up to the first newline
+	// https://wiki.multimedia.cx/index.php/YUV4MPEG2
+	const char *data = (const char *)mappedinput.base;
+	const char *headerend = (const char *)memchr(data, '\n', std::min(mappedinput.size, (size_t)1024));
+	if (mappedinput.size < 10 || strncmp(data, "YUV4MPEG2 ", 10) != 0 || !headerend)
+	{
+		std::cout << "Not a YUV4MPEG2 file: " << name << std::endl;
+		return false;
+	}
+	std::stringstream header(std::string(data + 10, headerend));
+	std::string field;
+	int fpsnum = 25, fpsden = 1;
+	std::string colourspace = "420jpeg";
+	while (header >> field)
+	{
+		switch (field[0])
+		{
+		case 'W': mappedinput.width = atoi(field.c_str() + 1); break;
+		case 'H': mappedinput.height = atoi(field.c_str() + 1); break;
+		case 'F': sscanf(field.c_str() + 1, "%d:%d", &fpsnum, &fpsden); break;
+		case 'C': colourspace = field.substr(1); break;
+		}
+	}
+	if (colourspace != "420" && colourspace != "420jpeg" && colourspace != "420paldv" && colourspace != "420mpeg2")
+	{
+		std::cout << "Only 8 bit 4:2:0 Y4M files are supported, this one is C" << colourspace << std::endl;
+		return false;
+	}
+	mappedinput.yuv = true;
+	mappedinput.centredchroma = colourspace == "420" || colourspace == "420jpeg";
+	mappedinput.fps = fpsden ? (double)fpsnum / fpsden : 25;
+	mappedinput.framebytes = (size_t)mappedinput.width * mappedinput.height * 3 / 2;
+	
+	// each frame is FRAME, optional parameters, a newline and the planes
+	size_t offset = headerend - data + 1;
+	while (offset + 6 <= mappedinput.size && strncmp(data + offset, "FRAME", 5) == 0)
+	{
+		const char *frameheaderend = (const char *)memchr(data + offset, '\n', std::min(mappedinput.size - offset, (size_t)256));
+		if (!frameheaderend)
+			break;
+		offset = frameheaderend - data + 1;
+		if (offset + mappedinput.framebytes > mappedinput.size)
+			break;
+		mappedinput.frameoffsets.push_back(offset);
+		offset += mappedinput.framebytes;
+	}
+	return !mappedinput.frameoffsets.empty();
+}
+
+Mat mappedFrame(unsigned long long frame)
+{
+	unsigned char *data = mappedinput.base + mappedinput.frameoffsets[frame];
+	if (mappedinput.yuv)
+		return Mat(mappedinput.height * 3 / 2, mappedinput.width, CV_8UC1, data);
+	return Mat(mappedinput.height, mappedinput.width, CV_8UC3, data);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ask the OS to start reading the next frames, so that the upload
+// does not wait for page faults on the GL thread
+///////////////////////////////////////////////////////////////////////////////
+void prefetchMappedFrames(unsigned long long frame, int count)
+{
+#ifndef _WIN32
+	static long pagesize = sysconf(_SC_PAGESIZE);
+	for (int i = 0; i < count && frame + i < mappedinput.frameoffsets.size(); i++)
+	{
+		size_t offset = mappedinput.frameoffsets[frame + i];
+		size_t aligned = offset - offset % pagesize;
+		madvise(mappedinput.base + aligned, mappedinput.framebytes + (offset - aligned), MADV_WILLNEED);
+	}
+#endif
+}
+
+void closeMappedInput()
+{
+#ifdef _WIN32
+	if (mappedinput.base)
+		UnmapViewOfFile(mappedinput.base);
+	if (mappedinput.mapping)
+		CloseHandle(mappedinput.mapping);
+	if (mappedinput.file != INVALID_HANDLE_VALUE)
+		CloseHandle(mappedinput.file);
+	mappedinput.mapping = NULL;
+	mappedinput.file = INVALID_HANDLE_VALUE;
+#else
+	if (mappedinput.base)
+		munmap(mappedinput.base, mappedinput.size);
+	if (mappedinput.fd >= 0)
+		close(mappedinput.fd);
+	mappedinput.fd = -1;
+#endif
+	mappedinput.base = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// YUV input - the decoder hands over its 4:2:0 planes in one single channel
+// Mat of height*3/2 rows, I420, and yuvFragmentShader converts to RGB
+// while the mesh samples them.
+///////////////////////////////////////////////////////////////////////////////
+bool isYUVFrame(const Mat &frame)
+{
+	return inputyuv && frame.type() == CV_8UC1 && frame.isContinuous()
+		&& frame.cols == texturew && frame.rows == textureh * 3 / 2;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// reads the first frame with CAP_PROP_CONVERT_RGB off, to check that the
+// backend really hands over I420 planes. Some return just the Y plane,
+// or NV12, whose interleaved chroma would be shown garbled.
+///////////////////////////////////////////////////////////////////////////////
+bool decodesToI420()
+{
+	if (mappedinput.yuv)
+		return true;	// y4m is always I420
+	VideoCapture probe(inputfilename);
+	if (!probe.isOpened())
+		return false;
+	probe.set(CAP_PROP_CONVERT_RGB, 0);
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2)))
+	// the fourcc of the decoder's pixel format, where the backend has it
+	int format = (int)probe.get(CAP_PROP_CODEC_PIXEL_FORMAT);
+	if (format > 0 && format != VideoWriter::fourcc('I', '4', '2', '0'))
+		return false;
+#endif
+	Mat frame;
+	probe >> frame;
+	return isYUVFrame(frame);
+}
+
+void initYUV()
+{
+	yuvProgram = linkProgram(warpshaders ? warpVertexShader : NULL, yuvFragmentShader, lutTextureId != 0);
+	if (!yuvProgram)
+	{
+		std::cout << "YUV shader not available, decoding to BGR instead." << std::endl;
+		inputyuv = 0;
+		return;
+	}
+	glUseProgram(yuvProgram);
+	glUniform1i(glGetUniformLocation(yuvProgram, "ytex"), 0);
+	glUniform1i(glGetUniformLocation(yuvProgram, "utex"), 1);
+	glUniform1i(glGetUniformLocation(yuvProgram, "vtex"), 2);
+	// MPEG-2 / H.264 chroma is sited with the left luma sample of each pair,
+	// JPEG style Y4M chroma is centred between them
+	float chromaoffset = (mappedinput.yuv && mappedinput.centredchroma) ? 0.0f : 0.5f / texturew;
+	glUniform2f(glGetUniformLocation(yuvProgram, "chromaoffset"), chromaoffset, 0.0f);
+	setMeshOrtho(yuvProgram);
+	setLUTUniforms(yuvProgram);
+	glUseProgram(0);
+	
+	glGenTextures(3, yuvtextureIds);
+	for (int i = 0; i < 3; i++)
+	{
+		int w = i ? texturew / 2 : texturew;
+		int h = i ? textureh / 2 : textureh;
+		glBindTexture(GL_TEXTURE_2D, yuvtextureIds[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, 0);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	
+	// the ffmpeg backend then skips its own conversion to BGR
+	inputVideo.set(CAP_PROP_CONVERT_RGB, 0);
+	std::cout << "Requesting I420 frames, converting to RGB in the warp shader." << std::endl;
+}
+
+void uploadYUV(const Mat &frame)
+{
+	int w = texturew, h = textureh;
+	int cw = w / 2, ch = h / 2;
+	const uchar *y = beginUpload(frame);
+	const uchar *u = y + w * h;
+	const uchar *v = u + cw * ch;
+	
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, yuvtextureIds[1]);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cw, ch, GL_RED, GL_UNSIGNED_BYTE, u);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, yuvtextureIds[2]);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cw, ch, GL_RED, GL_UNSIGNED_BYTE, v);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, yuvtextureIds[0]);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RED, GL_UNSIGNED_BYTE, y);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	endUpload();
+	
+	frameProgram = yuvProgram;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// copies frame into the next pixel unpack buffer of the ring and leaves it
+// bound, so that the following glTexSubImage2D calls return at once and the
+// transfer to the texture runs on the GPU while the CPU goes on to the next
+// frame. The rows keep the layout of frame, so the same unpack parameters
+// apply. Returns the pointer to give glTexSubImage2D: the offset into the
+// buffer, or frame.data itself when no PBOs are used or the map fails.
+// Each buffer keeps its storage, and is fenced by endUpload(), so it is
+// only written again when its transfer is done - normally long before,
+// while the uploads from the other buffers of the ring are in flight.
+// Without ARB_sync, the map itself waits for the transfer instead.
+///////////////////////////////////////////////////////////////////////////////
+const uchar *beginUpload(const Mat &frame)
+{
+	int slot = slotOf(frame);
+	if (slot >= 0)
+	{
+		// already in the persistently mapped buffer, nothing to copy
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slotbufferId);
+		uploadingslot = true;
+		return (const uchar *)0 + (frame.data - slotbase);
+	}
+	if (unpackpboIds.empty())
+		return frame.data;
+	size_t bytes = (frame.rows - 1) * frame.step + frame.cols * frame.elemSize();
+	int k = unpackpboIndex;
+	unpackpboIndex = (unpackpboIndex + 1) % unpackpboIds.size();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackpboIds[k]);
+	GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+	if (unpackpbofences[k])
+	{
+		GLenum wait;
+		do
+			wait = glClientWaitSync(unpackpbofences[k], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+		while (wait == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(unpackpbofences[k]);
+		unpackpbofences[k] = 0;
+		if (wait != GL_WAIT_FAILED)
+			access |= GL_MAP_UNSYNCHRONIZED_BIT;	// nothing reads it any more
+	}
+	if (unpackpbobytes[k] < bytes)
+	{
+		// only when the first frames are copied in, or grow
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, 0, GL_STREAM_DRAW);
+		unpackpbobytes[k] = bytes;
+	}
+	uchar *mapped = mapRangeSupported ? (uchar *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, access) 
+		: (uchar *)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if (!mapped)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return frame.data;
+	}
+	memcpy(mapped, frame.data, bytes);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	uploadingpbo = k;
+	return (const uchar *)0;
+}
+
+void endUpload()
+{
+	if (uploadingslot)
+	{
+		// the slot may be written again once this upload has completed
+		if (heldslotfence)
+			glDeleteSync(heldslotfence);
+		heldslotfence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		uploadingslot = false;
+	}
+	if (uploadingpbo >= 0)
+	{
+		// the buffer may be filled again once this upload has completed
+		if (syncSupported)
+			unpackpbofences[uploadingpbo] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		uploadingpbo = -1;
+	}
+	if (!unpackpboIds.empty() || slotbufferId)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// persistently mapped upload slots - one buffer with ARB_buffer_storage,
+// mapped once, and cut into slots of one prepared frame each. The decode
+// threads take a free slot and decode, resize or flip straight into it
+// through a Mat header, so that the frame is never copied again on the
+// CPU: beginUpload just points glTexSubImage2D at the slot.
+// displayCB holds on to the slot of its current frame, which is also
+// the previous frame for isDuplicateFrame, until the next one is popped,
+// then waits for the fence of its upload and hands the slot back.
+///////////////////////////////////////////////////////////////////////////////
+void initUploadSlots()
+{
+	if (!persistentslots)
+		return;
+	slotbytes = (size_t)texturew * textureh * (inputyuv ? 1 : 3);
+	if (inputyuv)
+		slotbytes += slotbytes / 2;
+	// a frame for each place in the queue, one being decoded by each
+	// thread, and the one displayCB holds - but with the long queues of
+	// several decode threads, only as many as fit in MAX_UPLOAD_SLOT_BYTES.
+	// The frames beyond them are decoded into ordinary Mats.
+	size_t wanted = queuewindow + decodethreads + 1;
+	slotcount = (int)std::min(wanted, std::max((size_t)2, (size_t)MAX_UPLOAD_SLOT_BYTES / slotbytes));
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &slotbufferId);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slotbufferId);
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slotbytes * slotcount, 0, flags);
+	slotbase = (uchar *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotbytes * slotcount, flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!slotbase)
+	{
+		std::cout << "Could not map the upload slots, decoding into client memory." << std::endl;
+		glDeleteBuffers(1, &slotbufferId);
+		slotbufferId = 0;
+		return;
+	}
+	freeslots.clear();
+	for (int i = slotcount - 1; i >= 0; i--)
+		freeslots.push_back(i);
+	std::cout << "Decoding into " << slotcount << " persistently mapped upload slots." << std::endl;
+}
+
+void freeUploadSlots()
+{
+	if (!slotbufferId)
+		return;
+	if (heldslotfence)
+		glDeleteSync(heldslotfence);
+	heldslotfence = 0;
+	heldslot = -1;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slotbufferId);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(1, &slotbufferId);
+	slotbufferId = 0;
+	slotbase = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// for the decode threads - a Mat header on a free slot. Returns an empty
+// Mat when there are no slots, or none is free, and the frame is then
+// decoded into ordinary memory and uploaded from there.
+///////////////////////////////////////////////////////////////////////////////
+Mat acquireSlot()
+{
+	if (!slotbase)
+		return Mat();
+	std::lock_guard<std::mutex> lock(queueMutex);
+	if (freeslots.empty())
+		return Mat();
+	int slot = freeslots.back();
+	freeslots.pop_back();
+	uchar *data = slotbase + slot * slotbytes;
+	if (inputyuv)
+		return Mat(textureh * 3 / 2, texturew, CV_8UC1, data);
+	return Mat(textureh, texturew, CV_8UC3, data);
+}
+
+void releaseSlot(int slot)
+{
+	if (slot < 0)
+		return;
+	std::lock_guard<std::mutex> lock(queueMutex);
+	freeslots.push_back(slot);
+}
+
+int slotOf(const Mat &frame)
+{
+	if (!slotbase || frame.data < slotbase || frame.data >= slotbase + slotbytes * slotcount)
+		return -1;
+	return (frame.data - slotbase) / slotbytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// called by displayCB with each frame it pops. Returns the slot of the
+// frame before, once its upload is done, for the caller to hand back to
+// the decode threads with releaseSlot() when it has finished with it.
+///////////////////////////////////////////////////////////////////////////////
+int holdSlot(const Mat &frame)
+{
+	if (!slotbase)
+		return -1;
+	if (heldslotfence)
+	{
+		// normally long signalled, by the readback of that frame,
+		// but the slot must not be written before its upload is done
+		GLenum wait;
+		do
+			wait = glClientWaitSync(heldslotfence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+		while (wait == GL_TIMEOUT_EXPIRED);
+		if (wait == GL_WAIT_FAILED)
+			glFinish();
+		glDeleteSync(heldslotfence);
+		heldslotfence = 0;
+	}
+	int previousslot = heldslot;
+	heldslot = slotOf(frame);
+	return previousslot;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decode thread - prepares the decoded frame into its slot, if it is not
+// there already. Gives the slot back, and returns the frame as it is,
+// if it does not fit.
+///////////////////////////////////////////////////////////////////////////////
+Mat prepareIntoSlot(const Mat &decoded, Mat &slot)
+{
+	Mat prepared = slot;	// prepareFrame writes into it when it flips or resizes
+	prepareFrame(decoded, prepared);
+	if (slot.empty() || prepared.data == slot.data)
+		return prepared;
+	if (prepared.rows == slot.rows && prepared.cols == slot.cols && prepared.type() == slot.type())
+	{
+		prepared.copyTo(slot);
+		return slot;
+	}
+	releaseSlot(slotOf(slot));
+	slot = Mat();
+	return prepared;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// frame number for --start and --end, given either as a frame number
+// or as a timecode hh:mm:ss.sss (or mm:ss, or ss.sss with a colon before it)
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long parseFrameOrTimecode(std::string str, double fps)
+{
+	if (str.find(':') == std::string::npos)
+		return strtoull(str.c_str(), NULL, 10);
+	
+	double seconds = 0;
+	std::stringstream ss(str);
+	std::string field;
+	while (std::getline(ss, field, ':'))
+		seconds = seconds * 60 + atof(field.c_str());
+	return (unsigned long long)(seconds * fps + 0.5);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// storage for the bound source texture, or tile, allocated once.
+// With ARB_texture_storage it is immutable, otherwise just level 0
+// is given here, and glGenerateMipmap allocates the others.
+///////////////////////////////////////////////////////////////////////////////
+void allocSourceTexture(int w, int h)
+{
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,sourcelevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR); 
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL, sourcelevels - 1);
+	if (texstorageSupported)
+		glTexStorage2D(GL_TEXTURE_2D, sourcelevels, GL_RGBA8, w, h);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tiled source, for inputs larger than GL_MAX_TEXTURE_SIZE.
+// The frame is cut into a grid of tiles of about equal size, each held in
+// its own texture with a border of one texel copied from its neighbours,
+// so that GL_LINEAR filtering is seamless across the tiles. The mesh
+// triangles are clipped in u,v to the part of the frame each tile covers,
+// once here, so that CreateGrid just draws the pieces of each tile.
+///////////////////////////////////////////////////////////////////////////////
+void initSourceTiles()
+{
+	const int border = 1;
+	int core = sourcetilesize - 2 * border;
+	int cols = (texturew + core - 1) / core;
+	int rows = (textureh + core - 1) / core;
+	int corew = (texturew + cols - 1) / cols;
+	int coreh = (textureh + rows - 1) / rows;
+	size_t pieces = 0;
+	sourcetiles.clear();
+	for (int ty = 0; ty < rows; ty++)
+		for (int tx = 0; tx < cols; tx++)
+		{
+			int x0 = tx * corew, x1 = std::min(texturew, x0 + corew);
+			int y0 = ty * coreh, y1 = std::min(textureh, y0 + coreh);
+			SourceTile tile;
+			tile.x = std::max(0, x0 - border);
+			tile.y = std::max(0, y0 - border);
+			tile.w = std::min(texturew, x1 + border) - tile.x;
+			tile.h = std::min(textureh, y1 + border) - tile.y;
+			// the outer tiles also take what lies beyond the frame,
+			// which GL_CLAMP_TO_EDGE fills with the edge texels
+			tile.u0 = tx ? (float)x0 / texturew : -1e30f;
+			tile.u1 = tx < cols - 1 ? (float)x1 / texturew : 1e30f;
+			tile.v0 = ty ? (float)y0 / textureh : -1e30f;
+			tile.v1 = ty < rows - 1 ? (float)y1 / textureh : 1e30f;
+			clipMeshToTile(tile, tile.u0, tile.u1, tile.v0, tile.v1);
+			pieces += tile.triangles.size() / 3;
+			
+			glGenTextures(1, &tile.textureId);
+			glBindTexture(GL_TEXTURE_2D, tile.textureId);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			allocSourceTexture(tile.w, tile.h);
+			uploadMeshBuffers(tile.vboId, tile.triangles, NULL, NULL);
+			sourcetiles.push_back(tile);
+		}
+	std::cout << "Source split into " << cols << "x" << rows << " tiles, drawing " 
+		<< pieces << " mesh triangles." << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// clips one polygon, of n points, to the side of u (or v) = edge given by
+// keepbelow, with Sutherland-Hodgman. x, y and i are interpolated along.
+///////////////////////////////////////////////////////////////////////////////
+static std::vector<meshpoint> clipPolygon(const std::vector<meshpoint> &in, bool clipv, float edge, bool keepbelow)
+{
+	std::vector<meshpoint> out;
+	for (size_t k = 0; k < in.size(); k++)
+	{
+		const meshpoint &a = in[k];
+		const meshpoint &b = in[(k + 1) % in.size()];
+		float da = (clipv ? a.v : a.u) - edge;
+		float db = (clipv ? b.v : b.u) - edge;
+		if (keepbelow)
+		{
+			da = -da;
+			db = -db;
+		}
+		if (da >= 0)
+			out.push_back(a);
+		if ((da >= 0) != (db >= 0))
+		{
+			float t = da / (da - db);
+			meshpoint p;
+			p.x = a.x + t * (b.x - a.x);
+			p.y = a.y + t * (b.y - a.y);
+			p.u = a.u + t * (b.u - a.u);
+			p.v = a.v + t * (b.v - a.v);
+			p.i = a.i + t * (b.i - a.i);
+			if (clipv)
+				p.v = edge;		// exactly on the seam, for both tiles
+			else
+				p.u = edge;
+			out.push_back(p);
+		}
+	}
+	return out;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// fills tile.triangles with the mesh quads, as two triangles each,
+// clipped to u0..u1, v0..v1 and with u,v changed to the tile texture.
+///////////////////////////////////////////////////////////////////////////////
+void clipMeshToTile(SourceTile &tile, float u0, float u1, float v0, float v1)
+{
+	int nx = meshcolumns;
+	for (int j = 0; j < meshrows - 1; j++)
+		for (int i = 0; i < nx - 1; i++)
+		{
+			meshpoint *p = &mesh[nx*j+i];
+			if (p[0].i < 0 || p[1].i < 0 || p[nx].i < 0 || p[nx+1].i < 0)
+				continue;
+			// quick reject of quads wholly outside the tile
+			float umin = std::min(std::min(p[0].u, p[1].u), std::min(p[nx].u, p[nx+1].u));
+			float umax = std::max(std::max(p[0].u, p[1].u), std::max(p[nx].u, p[nx+1].u));
+			float vmin = std::min(std::min(p[0].v, p[1].v), std::min(p[nx].v, p[nx+1].v));
+			float vmax = std::max(std::max(p[0].v, p[1].v), std::max(p[nx].v, p[nx+1].v));
+			if (umax < u0 || umin > u1 || vmax < v0 || vmin > v1)
+				continue;
+			for (int half = 0; half < 2; half++)
+			{
+				std::vector<meshpoint> poly;
+				poly.push_back(p[0]);
+				poly.push_back(half ? p[nx+1] : p[1]);
+				poly.push_back(half ? p[nx] : p[nx+1]);
+				poly = clipPolygon(poly, false, u0, false);
+				poly = clipPolygon(poly, false, u1, true);
+				poly = clipPolygon(poly, true, v0, false);
+				poly = clipPolygon(poly, true, v1, true);
+				if (poly.size() < 3)
+					continue;
+				for (size_t k = 0; k < poly.size(); k++)
+				{
+					poly[k].u = (poly[k].u * texturew - tile.x) / tile.w;
+					poly[k].v = (poly[k].v * textureh - tile.y) / tile.h;
+				}
+				// as a fan, which keeps the winding of the quad
+				for (size_t k = 1; k + 1 < poly.size(); k++)
+				{
+					tile.triangles.push_back(toMeshVertex(poly[0]));
+					tile.triangles.push_back(toMeshVertex(poly[k]));
+					tile.triangles.push_back(toMeshVertex(poly[k+1]));
+				}
+			}
+		}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// how far the warp shrinks the source, in source texels per output pixel,
+// at the worst place of the mesh. For each quad, the derivatives of the
+// texel position along output x and y come from its two edges, as
+// GL does it for choosing the mip level. The projection of CreateGrid
+// puts TEXTURE_HEIGHT/2 output pixels on one mesh unit, along x and y.
+///////////////////////////////////////////////////////////////////////////////
+float meshMinification(int texw, int texh)
+{
+	float scale = TEXTURE_HEIGHT / 2.0f;
+	float worst = 0;
+	int nx = meshcolumns;
+	for (int j = 0; j < meshrows - 1; j++)
+		for (int i = 0; i < nx - 1; i++)
+		{
+			meshpoint *p = &mesh[nx*j+i];
+			if (p[0].i < 0 || p[1].i < 0 || p[nx].i < 0 || p[nx+1].i < 0)
+				continue;
+			// from each of two opposite corners, along both edges
+			for (int corner = 0; corner < 2; corner++)
+			{
+				meshpoint *o = corner ? &p[nx+1] : &p[0];
+				meshpoint *a = corner ? &p[nx] : &p[1];
+				meshpoint *b = corner ? &p[1] : &p[nx];
+				float xa = (a->x - o->x) * scale, ya = (a->y - o->y) * scale;
+				float xb = (b->x - o->x) * scale, yb = (b->y - o->y) * scale;
+				float ua = (a->u - o->u) * texw, va = (a->v - o->v) * texh;
+				float ub = (b->u - o->u) * texw, vb = (b->v - o->v) * texh;
+				float det = xa * yb - xb * ya;
+				if (fabs(det) < 1e-6f)
+					continue;
+				// texel derivatives = texel edges * inverse of pixel edges
+				float dudx = (ua * yb - ub * ya) / det, dvdx = (va * yb - vb * ya) / det;
+				float dudy = (ub * xa - ua * xb) / det, dvdy = (vb * xa - va * xb) / det;
+				float rho = std::max(sqrt(dudx*dudx + dvdx*dvdx), sqrt(dudy*dudy + dvdy*dvdy));
+				worst = std::max(worst, rho);
+			}
+		}
+	return worst;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mip levels worth having for a texture shrunk by up to ratio:1.
+// Bilinear filtering copes with 2:1, so below that only the base level.
+///////////////////////////////////////////////////////////////////////////////
+int mipLevelsNeeded(float ratio, int w, int h)
+{
+	int fullchain = 1;
+	while ((std::max(w, h) >> fullchain) > 0)
+		fullchain++;
+	if (ratio <= 2)
+		return 1;
+	int levels = (int)ceil(log2(ratio)) + 1;
+	return std::min(levels, fullchain);
+}
+
+bool ReadMesh(std::string strpathtowarpfile)
+{
+	//from https://github.com/hn-88/GL_warp2Avi/blob/master/GL2AviView.cpp
+	FILE *input = NULL;
+
+   input = fopen(strpathtowarpfile.c_str(), "r");
+
+   /* Set rows and columns to 2 initially, as this is the size of the default mesh. */
+    int dummy, rows = 2, cols = 2;
+
+    if (input != NULL)  {
+		fscanf(input, " %d %d %d ", &dummy, &cols, &rows) ;
+		float x, y, u, v, l;
+		meshrows=rows;
+		meshcolumns=cols;
+
+		// the following is adapted from the code at
+		// http://paulbourke.net/dataformats/meshwarp/
+
+
+		mesh		= (meshpoint*)calloc(rows*cols, sizeof(meshpoint));
+		 
+		//  (meshpoint*) explicit cast required for c++
+		//	  have to do an explicit cast
+		// since this is C++ and not C
+	// http://cboard.cprogramming.com/windows-programming/69549-%27initializing%27-cannot-convert-%27void-*%27-%27int-*%27.html
+
+
+	     for (int r = 0; r < rows ; r++) {
+             for (int c = 0; c < cols ; c++) {
+		                
+                fscanf(input, "%f %f %f %f %f", &x, &y, &u, &v, &l) ;                 
+                //   using the code adapted from 
+				// http://paulbourke.net/dataformats/meshwarp/
+				// and from vlc-warp
+				//   We pack the values for each node into a 1d array.  
+    
+                mesh[cols*r+c].x = x;
+                mesh[cols*r+c].y = y;
+                mesh[cols*r+c].u = u;
+                mesh[cols*r+c].v = v;
+                mesh[cols*r+c].i = l;
+                
+                if (flipinmesh)
+                {
+					// frames are uploaded top row first, and the output
+					// is rendered upside down so that glReadPixels
+					// returns it top row first - no flips needed per frame
+					mesh[cols*r+c].y = -y;
+					mesh[cols*r+c].v = 1.0f - v;
+				}
+ 
+				
+
+			}
+			 
+		}
+	}
+	else // unable to read mesh
+	{
+		std::cout << "Unable to read mesh data file (similar to EP_xyuv_1920.map), exiting!" << std::endl;
+		//onExitCleanup();
+		//clearSharedMem(); no need to explicitly call it.
+		exit(0);
+	}
+	fclose(input);
+	buildMeshArrays();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// vertex data for glDrawElements, built once when the mesh is read -
+// every mesh node, with its intensity as colour, and the two triangles
+// of each quad which has no negative intensity corner.
+// The triangles split the quads as GL_QUADS did, and keep their winding.
+///////////////////////////////////////////////////////////////////////////////
+meshvertex toMeshVertex(const meshpoint &p)
+{
+	meshvertex vertex = { p.x, p.y, p.u, p.v, p.i, p.i, p.i };
+	return vertex;
+}
+
+void buildMeshArrays()
+{
+	int nx = meshcolumns;
+	meshvertices.resize(meshrows * meshcolumns);
+	for (size_t k = 0; k < meshvertices.size(); k++)
+		meshvertices[k] = toMeshVertex(mesh[k]);
+	meshindices.clear();
+	for (int j = 0; j < meshrows - 1; j++)
+		for (int i = 0; i < nx - 1; i++)
+		{
+			GLuint k = nx*j+i;
+			if (mesh[k].i < 0 || mesh[k+1].i < 0 || mesh[k+nx].i < 0 || mesh[k+nx+1].i < 0)
+				continue;
+			GLuint quad[6] = { k, k+1, k+nx+1, k, k+nx+1, k+nx };
+			meshindices.insert(meshindices.end(), quad, quad + 6);
+		}
+	std::cout << "Mesh of " << meshcolumns << "x" << meshrows << " nodes, " 
+		<< meshindices.size() / 3 << " triangles." << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// copies vertex (and index) data into new GPU buffers, ids left 0 if
+// buffer objects are not available, to draw from client memory instead
+///////////////////////////////////////////////////////////////////////////////
+void uploadMeshBuffers(GLuint &vbo, const std::vector<meshvertex> &vertices, GLuint *ibo, const std::vector<GLuint> *indices)
+{
+	vbo = 0;
+	if (ibo)
+		*ibo = 0;
+	if (!vboSupported || vertices.empty())
+		return;
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(meshvertex), &vertices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (ibo && !indices->empty())
+	{
+		glGenBuffers(1, ibo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->size() * sizeof(GLuint), &(*indices)[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// one draw call for a whole mesh, from the buffers, or from the client
+// arrays given when the buffer ids are 0. Without indices, the vertices
+// are taken as a list of triangles.
+///////////////////////////////////////////////////////////////////////////////
+void drawMeshBuffers(GLuint vbo, const meshvertex *vertices, size_t count, GLuint ibo, const GLuint *indices)
+{
+	if (count == 0)
+		return;
+	const char *base = vbo ? (const char *)0 : (const char *)vertices;
+	if (vbo)
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	if (warpshaders)
+	{
+		glEnableVertexAttribArray(POSITION_ATTRIB);
+		glEnableVertexAttribArray(MESHUV_ATTRIB);
+		glEnableVertexAttribArray(INTENSITY_ATTRIB);
+		glVertexAttribPointer(POSITION_ATTRIB, 2, GL_FLOAT, GL_FALSE, sizeof(meshvertex), base + offsetof(meshvertex, x));
+		glVertexAttribPointer(MESHUV_ATTRIB, 2, GL_FLOAT, GL_FALSE, sizeof(meshvertex), base + offsetof(meshvertex, u));
+		glVertexAttribPointer(INTENSITY_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(meshvertex), base + offsetof(meshvertex, r));
+	}
+	else
+	{
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(2, GL_FLOAT, sizeof(meshvertex), base + offsetof(meshvertex, x));
+		glTexCoordPointer(2, GL_FLOAT, sizeof(meshvertex), base + offsetof(meshvertex, u));
+		glColorPointer(3, GL_FLOAT, sizeof(meshvertex), base + offsetof(meshvertex, r));
+	}
+	if (indices || ibo)
+	{
+		if (ibo)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, ibo ? 0 : indices);
+		if (ibo)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	else
+		glDrawArrays(GL_TRIANGLES, 0, count);
+	if (warpshaders)
+	{
+		glDisableVertexAttribArray(POSITION_ATTRIB);
+		glDisableVertexAttribArray(MESHUV_ATTRIB);
+		glDisableVertexAttribArray(INTENSITY_ATTRIB);
+	}
+	else
+	{
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState(GL_COLOR_ARRAY);
+	}
+	if (vbo)
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+		
+
+void CreateGrid()
+{
+	if (warpshaders)
+	{
+		// the vertex shader does the whole mapping, and a flat
+		// warp needs neither depth test nor culling
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+	}
+	else
+	{
+	// Set Projection Matrix
+	//~ glMatrixMode (GL_PROJECTION);
 	//~ glLoadIdentity();
 	gluOrtho2D(-0.2885 , 0.2885 , -0.2885 , 0.2885 );
 	// these seem to be due to the camera distance and 60 degree FOV
 	// found these numbers by trial and error!
 	glDisable(GL_LIGHTING);
 	glShadeModel(GL_SMOOTH);
+	}
+	if (frameProgram)
+		glUseProgram(frameProgram);
+	if (flipinmesh)
+		glFrontFace(GL_CW);	// y -> -y reverses the winding of the quads
 	
-	// from https://github.com/hn-88/GL_warp2Avi/blob/master/GL2AviView.cpp
-   int i,j;
-      
-   /*
-   using the code from 
-   http://paulbourke.net/dataformats/meshwarp/ */
-   
-   int nx = meshcolumns;
-   int ny = meshrows;
-   // here, the mesh[i][j].i etc are translated into the
-   // mesh[cols*r+c] variable etc in the 1d array
-   //  
-   //   mesh[i][j].i <===> mesh[nx*j+i].i
-   // Thanks, Paul!
-     
-   glBegin(GL_QUADS);
-   for (i=0;i<nx-1;i++) {
-      for (j=0;j<ny-1;j++) {
-         if (mesh[nx*j+i].i < 0 || mesh[(nx*(j+1))+i].i < 0 || mesh[(nx*(j+1))+(i+1)].i < 0 || mesh[nx*j+i+1].i < 0)
-            continue;
-
-         glColor3f(mesh[nx*j+i].i,mesh[nx*j+i].i,mesh[nx*j+i].i);
-         glTexCoord2f(mesh[nx*j+i].u,mesh[nx*j+i].v);
-         glVertex3f(mesh[nx*j+i].x,mesh[nx*j+i].y,0.0);
-
-         glColor3f(mesh[nx*j+i+1].i,mesh[nx*j+i+1].i,mesh[nx*j+i+1].i);
-         glTexCoord2f(mesh[nx*j+i+1].u,mesh[nx*j+i+1].v); 
-         glVertex3f(mesh[nx*j+i+1].x,mesh[nx*j+i+1].y,0.0);
-
-         glColor3f(mesh[nx*(j+1)+i+1].i,mesh[nx*(j+1)+i+1].i,mesh[nx*(j+1)+i+1].i);
-         glTexCoord2f(mesh[nx*(j+1)+i+1].u,mesh[nx*(j+1)+i+1].v);
-         glVertex3f(mesh[nx*(j+1)+i+1].x,mesh[nx*(j+1)+i+1].y,0.0);
-
-         glColor3f(mesh[nx*(j+1)+i].i,mesh[nx*(j+1)+i].i,mesh[nx*(j+1)+i].i);
-         glTexCoord2f(mesh[nx*(j+1)+i].u,mesh[nx*(j+1)+i].v);
-         glVertex3f(mesh[nx*(j+1)+i].x,mesh[nx*(j+1)+i].y,0.0);
-
-       }
-   }
+	// the vertices and the triangles of the valid quads are
+	// in GPU buffers since startup, see buildMeshArrays()
+	if (lutTextureId)
+	{
+		glActiveTexture(GL_TEXTURE0 + LUT_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, lutTextureId);
+		glActiveTexture(GL_TEXTURE0);
+		drawMeshBuffers(lutquadvboId, lutquad.data(), lutquad.size(), 0, NULL);
+	}
+	else if (sourcetiles.empty())
+		drawMeshBuffers(meshvboId, meshvertices.data(), meshindices.size(), meshiboId, meshindices.data());
+	else
+	{
+		for (size_t t = 0; t < sourcetiles.size(); t++)
+		{
+			SourceTile &tile = sourcetiles[t];
+			glBindTexture(GL_TEXTURE_2D, tile.textureId);
+			drawMeshBuffers(tile.vboId, tile.triangles.data(), tile.triangles.size(), 0, NULL);
+		}
+		glBindTexture(GL_TEXTURE_2D, srctextureId);
+	}
    //~ // testing code for checking if glortho has correct params
     //~ glTexCoord2f(1.0f, 1.0f); glVertex3f( 1.77778f,  1.0f, -0.0f);
 	//~ glTexCoord2f(0.0f, 1.0f); glVertex3f(-1.77778f,  1.0f, -0.0f);
 	//~ glTexCoord2f(0.0f, 0.0f); glVertex3f(-1.77778f, -1.0f, -0.0f);
 	//~ glTexCoord2f(1.0f, 0.0f); glVertex3f( 1.77778f, -1.0f, -0.0f);
-	
-	//~ glTexCoord2f(1.0f, 1.0f); glVertex3f( 1.0f,  1.0f, -0.0f);
-	//~ glTexCoord2f(0.0f, 1.0f); glVertex3f(-1.0f,  1.0f, -0.0f);
-	//~ glTexCoord2f(0.0f, 0.0f); glVertex3f(-1.0f, -1.0f, -0.0f);
-	//~ glTexCoord2f(1.0f, 0.0f); glVertex3f( 1.0f, -1.0f, -0.0f);
-	
-	//~ glTexCoord2f(1.0f, 1.0f); glVertex3f( 3.0f,  3.0f, -0.0f);
-	//~ glTexCoord2f(0.0f, 1.0f); glVertex3f(-3.77778f,  3.0f, -0.0f);
-	//~ glTexCoord2f(0.0f, 0.0f); glVertex3f(-3.77778f, -3.0f, -0.0f);
-	//~ glTexCoord2f(1.0f, 0.0f); glVertex3f( 3.77778f, -3.0f, -0.0f);
-	
 
-   
-   glEnd();
+   if (frameProgram)
+		glUseProgram(0);
+   glFrontFace(GL_CCW);
+   if (warpshaders)
+   {
+		glEnable(GL_DEPTH_TEST);
+		glEnable(GL_CULL_FACE);
+   }
 }
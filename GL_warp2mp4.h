@@ -19,27 +19,340 @@ int windoww = 800;
 int windowh = 600;
 int texturew = 2056;
 int textureh = 2056;
+// 0 resizes frames on the CPU to texturew x textureh,
+// 1 uploads them at native size and lets the warp scale them,
+// 2 is like 1, with a bicubic filter shader instead of GL_LINEAR
+int sourcescaling = 0;
+// 0 samples the source with GL_LINEAR only, as it always was, 1 adds as
+// many mip levels as the mesh needs (often none), 2 always the full chain.
+// The mipmaps are generated on the GPU after each upload.
+int sourcemipmaps = 0;
+int sourcelevels = 1;
+int fbolevels = 1;				// mip levels of the preview texture
+float meshMinification(int texw, int texh);
+int mipLevelsNeeded(float ratio, int w, int h);
+// 1 pre-transforms the mesh in ReadMesh (v -> 1-v, y -> -y)
+// so that frames need not be flipped before upload or after readback
+int flipinmesh = 0;
+// 1 asks the decoder for I420 frames instead of BGR, uploads
+// the planes as they are and converts in the warp shader
+int inputyuv = 0;
+// 1 compares each input frame with the previous one and, when it
+// is the same, writes the previous output again without warping
+int skipduplicates = 0;
+unsigned long long duplicateframes = 0;
+Mat prevframe;
+unsigned long long prevframehash = 0;
+unsigned long long frameHash(const Mat &frame);
+bool isDuplicateFrame(const Mat &frame);
 char *pixels;
 int returncode;
 
-void getNextFrame();
+bool getNextFrame();
+bool readNextFrame(bool &duplicate);
+void uploadFrame();
+void warpView();
 void CreateGrid();
-void CreateGridNoColor();
 bool ReadMesh(std::string strpathtowarpfile);
 
+// decode threads, filling a bounded queue of frames
+// which are already flipped and resized for upload,
+// so that displayCB only has to pop the next one.
+// decodequeuedepth = 0 decodes inside displayCB as before.
+// With decodethreads > 1, each thread has its own VideoCapture
+// and decodes segments of segmentframes frames, seeking with
+// CAP_PROP_POS_FRAMES. frameQueue is keyed by frame number, so it
+// also works as the reorder buffer for the segments.
+// A seek decodes and drops the frames from the keyframe before it,
+// up to a whole GOP (250 frames with x264), so segments are a GOP
+// long by default, at the cost of decodethreads x segmentframes
+// frames held in memory.
+int decodequeuedepth = 4;
+int decodethreads = 1;
+int segmentframes = 250;
+std::string inputfilename;
+std::vector<std::thread> decodeThreads;
+std::mutex queueMutex;
+std::condition_variable queueNotFull, queueNotEmpty;
+std::map<unsigned long long, Mat> frameQueue;
+unsigned long long queuewindow;					// frames allowed ahead of nextframeout
+unsigned long long nextframeout = 0;			// next frame displayCB will get
+unsigned long long nextsegmentstart = 0;		// next segment to hand to a decode thread
+unsigned long long decodeendframe = ULLONG_MAX;	// set when the end of input is found
+bool decodeStop = false;						// set on exit, to stop the threads
+int decodeopenfailures = 0;						// decode threads that could not open the input
+bool decodeFailed = false;						// set when none of them could
+
+void startDecoder();
+void stopDecoder();
+void decodeLoop(int thread);
+bool nextSegment(unsigned long long &start, unsigned long long &end);
+bool pushFrame(unsigned long long frame, const Mat &prepared);
+void finishDecode(unsigned long long endframe);
+bool popFrame(Mat &frame);
+bool seekToFrame(VideoCapture &capture, unsigned long long frame);
+bool seekLandsExactly();
+void prepareFrame(const Mat &in, Mat &out);
+
+// image sequence input, read by imagethreads threads with imread
+std::vector<std::string> sequencefiles;
+int imagethreads = 8;
+double sequencefps = 30;
+bool isImageFile(const std::string &name);
+bool isDirectory(const std::string &name);
+bool fileExists(const std::string &name);
+bool isImageSequence(const std::string &input);
+bool parseSequencePattern(const std::string &input, std::string &prefix, int &digits, std::string &suffix);
+std::string sequenceFileName(const std::string &prefix, int digits, const std::string &suffix, unsigned long long number);
+bool splitFrameNumber(const std::string &name, std::string &prefix, std::string &number, std::string &suffix);
+void listDirectory(const std::string &dir, std::vector<std::string> &names);
+bool listImageSequence(const std::string &input, std::string &outputbase);
+void decodeImages(int thread);
+
+// memory mapped .y4m or raw BGR input, read without decoding
+int rawwidth = 1920;
+int rawheight = 1080;
+typedef struct {
+	unsigned char *base;		// start of the mapping, NULL if not used
+	size_t size;
+	int width, height;
+	double fps;
+	bool yuv;					// I420 frames, otherwise BGR24
+	bool centredchroma;			// 420jpeg chroma siting, not 420mpeg2
+	size_t framebytes;
+	std::vector<size_t> frameoffsets;
+#ifdef _WIN32
+	HANDLE file, mapping;
+#else
+	int fd;
+#endif
+} MappedInput;
+
+#ifdef _WIN32
+MappedInput mappedinput = { NULL, 0, 0, 0, 0, false, false, 0, std::vector<size_t>(), INVALID_HANDLE_VALUE, NULL };
+#else
+MappedInput mappedinput = { NULL, 0, 0, 0, 0, false, false, 0, std::vector<size_t>(), -1 };
+#endif
+
+bool isMappedInput(const std::string &name);
+bool openMappedInput(const std::string &name);
+Mat mappedFrame(unsigned long long frame);
+void prefetchMappedFrames(unsigned long long frame, int count);
+void closeMappedInput();
+
+// number of pixel unpack buffers the source frames are
+// uploaded through, 0 uploads straight from client memory
+int uploadpbos = 3;
+const uchar *beginUpload(const Mat &frame);
+void endUpload();
+
+// 1 lets the decode threads write frames straight into persistently
+// mapped upload slots (ARB_buffer_storage), see initUploadSlots()
+int persistentslots = 0;
+#define MAX_UPLOAD_SLOT_BYTES	(512 << 20)	// mapped at most
+GLuint slotbufferId = 0;
+uchar *slotbase = NULL;			// mapping of the whole buffer
+size_t slotbytes = 0;
+int slotcount = 0;
+std::vector<int> freeslots;		// guarded by queueMutex
+int heldslot = -1;				// slot of the frame displayCB is using
+GLsync heldslotfence = 0;		// signalled when its upload has completed
+bool uploadingslot = false;
+void initUploadSlots();
+void freeUploadSlots();
+Mat acquireSlot();
+void releaseSlot(int slot);
+int slotOf(const Mat &frame);
+int holdSlot(const Mat &frame);
+Mat prepareIntoSlot(const Mat &decoded, Mat &slot);
+
+bool isYUVFrame(const Mat &frame);
+bool decodesToI420();
+void initYUV();
+void uploadYUV(const Mat &frame);
+
 // from GL_warp2Avi
 uint nFrames;
 
+// frame range from the --start and --end arguments,
+// endframe = 0 renders till the end of the input
+unsigned long long startframe = 0;
+unsigned long long endframe = 0;
+unsigned long long parseFrameOrTimecode(std::string str, double fps);
+
+// stage benchmark from the --bench and --benchframes arguments
+std::string benchmode;
+int benchframes = 300;
+void runBenchmark();
+void printBenchStage(const char *stage, double ms, int frames);
+
 typedef struct {
    GLfloat x,y,u,v,i;
 } meshpoint;
 
 meshpoint *mesh;
 
-// adding this for adapting vlc-warp code 
-GLfloat *coords;
-GLfloat *uv;
-GLfloat *intensity;
+// interleaved vertex data for drawing the mesh with glDrawElements
+typedef struct {
+   GLfloat x,y,u,v,r,g,b;
+} meshvertex;
+
+std::vector<meshvertex> meshvertices;
+std::vector<GLuint> meshindices;	// triangles of the valid quads
+GLuint meshvboId = 0, meshiboId = 0;
+meshvertex toMeshVertex(const meshpoint &p);
+void buildMeshArrays();
+void uploadMeshBuffers(GLuint &vbo, const std::vector<meshvertex> &vertices, GLuint *ibo, const std::vector<GLuint> *indices);
+void drawMeshBuffers(GLuint vbo, const meshvertex *vertices, size_t count, GLuint ibo, const GLuint *indices);
+
+// 1 warps with warpVertexShader and a fragment shader, using generic
+// attributes at these locations, 0 with the fixed function pipeline
+int warpshaders = 1;
+#define POSITION_ATTRIB		0
+#define MESHUV_ATTRIB		1
+#define INTENSITY_ATTRIB	2
+void setMeshOrtho(GLuint program, bool checkmesh = true);
+
+// warp lookup texture, 0 draws the mesh every frame, 1 always renders
+// it once into the lookup texture, 2 only for very dense meshes.
+// Off by default, as the sampled lookup is not bit identical to
+// drawing the mesh at its edges and for dense meshes.
+int warplut = 0;
+GLuint lutTextureId = 0;
+GLuint lutquadvboId = 0;
+std::vector<meshvertex> lutquad;	// covers the output, drawn instead of the mesh
+#define LUT_TEXTURE_UNIT	3
+extern const char *lutFragmentMain;
+void initWarpLUT();
+void setLUTUniforms(GLuint program);
+
+// preview window refresh, every previewframes frames (0 never) and/or
+// every previewms milliseconds (0 not timed)
+int previewframes = 1;
+int previewms = 0;
+bool previewDue();
+// frame rate shown in the preview, of all the frames rendered
+std::string fpsstring = "0.0 FPS";
+void countFPS(int frames);
+
+// with an FBO, displayCB warps batchframes frames into batchfboIds
+// (fboId and batchframes - 1 more) before reading any of them back
+int batchframes = 4;
+int batchcount = 0;					// frames warped but not yet written
+std::vector<GLuint> batchfboIds;
+std::vector<GLuint> batchtextureIds;	// of all but fboId
+std::vector<bool> batchwarped;			// false for a repeated input frame
+int previewslot = 0;					// the batch FBO the preview shows
+void initBatchFBOs();
+void freeBatchFBOs();
+void writeBatch();
+
+// ring of pixel pack buffers the batch FBOs are read back through,
+// 0 reads back with a plain glReadPixels
+int readbackpbos = 3;
+std::vector<GLuint> packpboIds;
+int packpboIndex = 0;
+typedef struct {
+	int pbo;						// index in packpboIds
+	int repeats;					// repeated input frames written after it
+	GLsync fence;					// 0 without ARB_sync
+} PendingReadback;
+std::deque<PendingReadback> pendingreadbacks;
+void initReadbackPBOs();
+void freeReadbackPBOs();
+void queueReadback(int batchframe);
+void finishReadback();
+void flushReadbacks();
+
+// 1 packs the output into BGR rows, top row first, on the GPU, in an FBO
+// of 3/4 the width, so that the readback goes to the encoder as it is.
+// 0 converts it with cvtColor after the readback.
+int packreadback = 1;
+GLuint packProgram = 0;
+GLuint packfboId = 0, packtextureId = 0;
+GLuint packquadvboId = 0;
+std::vector<meshvertex> packquad;
+void initPackProgram();
+void initPackFBO();
+void freePackFBO();
+void packBatchFrame(int batchframe);
+void readBatchFrame(int batchframe, uchar *pixels);
+bool packSize(int &w, int &h);
+Mat packedFrame(uchar *data);
+
+// 1 packs the output into I420 instead, read back at 1.5 bytes per pixel
+// and written as y4m, not through VideoWriter. yuvcommand other than NONE
+// gets the y4m on its standard input, see openY4M().
+int outputyuv = 0;
+std::string yuvcommand = "NONE";
+FILE *openY4M(const std::string &name, int w, int h, double fps);
+void closeY4M(FILE *file);
+void writeFrame(size_t c, const Mat &frame);
+bool exiting = false;				// set by exitCB, so writeFrame does not exit again
+
+// 1 reads back and converts only the bands of rows and columns the mesh
+// covers, see initActiveRegion(), 0 the whole frame
+int activeregion = 1;
+#define ACTIVE_BAND_ROWS	32
+std::vector<Rect> activebands;		// output pixels, top row first
+void initActiveRegion();
+Rect renderedBand(const Rect &band);
+Mat convertActive(const Mat &rgba);
+
+// tiled source, for inputs larger than GL_MAX_TEXTURE_SIZE
+typedef struct {
+	GLuint textureId;
+	GLuint vboId;
+	int x, y, w, h;						// part of the frame held, borders included
+	float u0, u1, v0, v1;				// part of the frame its triangles are clipped to
+	std::vector<meshvertex> triangles;	// mesh clipped to the tile, u,v of the tile texture
+} SourceTile;
+
+int sourcetilesize = 0;					// GL_MAX_TEXTURE_SIZE when tiled, otherwise 0
+std::vector<SourceTile> sourcetiles;
+bool texstorageSupported = false;
+void allocSourceTexture(int w, int h);
+void initSourceTiles();
+void clipMeshToTile(SourceTile &tile, float u0, float u1, float v0, float v1);
+
+// more warp files, each into its own output, from the same decode and
+// upload. channels[0] is the one from pathtowarpfile. The state of the
+// selected channel is in the globals, see useChannel(), and its
+// WarpChannel holds the state of the one selected before it.
+typedef struct {
+	std::string warpfile;
+	std::string suffix;					// added to the output filename after W
+	VideoWriter *output;
+	FILE *yuvoutput;					// used instead with Output_YUV
+	// exchanged with the globals
+	int width, height;					// TEXTURE_WIDTH, TEXTURE_HEIGHT
+	meshpoint *mesh;
+	int meshrows, meshcolumns;
+	std::vector<meshvertex> meshvertices;
+	std::vector<GLuint> meshindices;
+	GLuint meshvboId, meshiboId;
+	GLuint lutTextureId, lutquadvboId;
+	std::vector<meshvertex> lutquad;
+	std::vector<SourceTile> sourcetiles;	// textures of channel 0, own triangles
+	GLuint fboId, fbotextureId, rboDepthId;
+	std::vector<GLuint> batchfboIds, batchtextureIds;
+	std::vector<GLuint> packpboIds;
+	GLuint packfboId, packtextureId;
+	Mat dst, dstbgr, flipped;
+	std::vector<Rect> activebands;
+	// not exchanged - the uniform locations of warpProgram and yuvProgram
+	// set by useChannel, looked up once for the program they were for
+	GLuint uniformprograms[2];
+	GLint orthoLocation[2], lutsizeLocation[2];
+} WarpChannel;
+
+int extrachannels = 0;
+std::vector<WarpChannel> channels(1);
+size_t currentchannel = 0;
+void swapChannel(WarpChannel &channel);
+void useChannel(size_t c);
+void initChannels(const std::string &namestart, const std::string &nameend, int fourcc, double fps);
+void freeChannels();
 
 int meshrows, meshcolumns;
  